@@ -0,0 +1,85 @@
+#include "Test.hpp"
+#include "rlm3-log-buffer.h"
+#include "rlm3-memory.h"
+#include "rlm3-settings.h"
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+
+
+static constexpr size_t BUFFER_SIZE = sizeof(ExternalMemoryLayout::log_buffer);
+static constexpr size_t RECORD_COUNT = 1000000;
+
+
+static void RunBench(const char* name, const std::function<void(size_t)>& write)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+
+	// Drain the ring as a consumer would so the writes keep wrapping around it.
+	uint64_t total_bytes = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < RECORD_COUNT; i++)
+	{
+		write(i);
+		uint32_t used = EXTERNAL_MEMORY->log_head - EXTERNAL_MEMORY->log_tail;
+		if (used > BUFFER_SIZE / 2)
+		{
+			total_bytes += used;
+			EXTERNAL_MEMORY->log_tail = RLM3_LogBuffer_FetchBlock(BUFFER_SIZE);
+		}
+	}
+	total_bytes += EXTERNAL_MEMORY->log_head - EXTERNAL_MEMORY->log_tail;
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	RLM3_LogBufferStats stats;
+	RLM3_LogBuffer_GetStats(&stats);
+	ASSERT(stats.overflow_count == 0);
+	std::printf("%-20s %8.1f MB/s %8.1f ns/record %6.1f bytes/record\n", name, total_bytes / seconds / 1e6, seconds * 1e9 / RECORD_COUNT, (double)total_bytes / RECORD_COUNT);
+
+	RLM3_LogBuffer_Deinit();
+}
+
+
+TEST_CASE(Bench_LogRecord)
+{
+	RunBench("log record", [](size_t i)
+	{
+		RLM3_LogBuffer_FormatLogMessage("INFO", "MOTOR", "speed %d rpm current %u mA", (int)(i % 3000), (unsigned)(i % 1700));
+	});
+}
+
+TEST_CASE(Bench_LogRecord_Text)
+{
+	static const std::string text(100, 'x');
+	RunBench("log record text", [](size_t i)
+	{
+		RLM3_LogBuffer_FormatLogMessage("WARN", "NETWORK", "%s", text.c_str());
+	});
+}
+
+TEST_CASE(Bench_RawRecord)
+{
+	RunBench("raw record", [](size_t i)
+	{
+		RLM3_LogBuffer_FormatRawMessage("R %u ok", (unsigned)i);
+	});
+}
+
+TEST_CASE(Bench_DebugChar)
+{
+	static const char* const SENTENCE = "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47";
+	RunBench("debug line", [](size_t i)
+	{
+		for (const char* c = SENTENCE; *c != 0; c++)
+			RLM3_LogBuffer_DebugChar("gps", *c);
+		RLM3_LogBuffer_DebugChar("gps", '\n');
+	});
+}
+
+TEST_TEARDOWN(LOG_BUFFER_BENCH_TEARDOWN)
+{
+	if (RLM3_LogBuffer_IsInit())
+		RLM3_LogBuffer_Deinit();
+}
@@ -0,0 +1,320 @@
+#include "rlm3-fw-command.h"
+#include "rlm3-log-buffer.h"
+#include "logger.h"
+#include "Assert.h"
+#include "rlm3-base.h"
+#include "rlm3-settings.h"
+#include "rlm3-task.h"
+#include "rlm3-string.h"
+#include <string.h>
+#include <stdarg.h>
+
+
+#define COMMAND_BUFFER_SIZE (512)
+#define COMMAND_MAX_ARGS (8)
+#define COMMAND_MAX_HANDLERS (16)
+#define COMMAND_MAX_RESPONSE (128)
+#define COMMAND_CORRUPT_TERMINATOR ('\x18') // Marks a frame that lost characters to an overflow.
+
+static_assert((COMMAND_BUFFER_SIZE & (COMMAND_BUFFER_SIZE - 1)) == 0, "Command buffer size must be a power of two.");
+
+static const RLM3_Time COMMAND_BUDGET_MS = 5;
+static const RLM3_Time DISPATCH_BUDGET_MS = 10;
+
+
+LOGGER_ZONE(FW_COMMAND);
+
+
+typedef struct
+{
+	const char* name;
+	RLM3_FwCommand_Handler handler;
+} CommandEntry;
+
+
+static volatile bool g_is_initialized = false;
+
+static char g_buffer[COMMAND_BUFFER_SIZE];
+static volatile size_t g_head; // Written only by the receive ISRs.
+static volatile size_t g_tail; // Written only by the dispatcher.
+static volatile bool g_is_discarding = false;
+static volatile bool g_is_corrupt_terminator_pending = false;
+static volatile RLM3_Task g_dispatch_task = NULL;
+
+static size_t g_scan; // Position where the dispatcher stopped looking for a frame terminator.
+static char g_scratch[COMMAND_BUFFER_SIZE]; // Only used for frames that wrap the end of the buffer.
+static bool g_is_frame_parsed = false;
+static size_t g_frame_size;
+static size_t g_argc;
+static char* g_argv[COMMAND_MAX_ARGS];
+static const char* g_current_id = NULL;
+static RLM3_Time g_command_start;
+
+static CommandEntry g_handlers[COMMAND_MAX_HANDLERS];
+static size_t g_handler_count = 0;
+
+
+static RLM3_FwCommand_Result PingCommand(size_t argc, char** argv)
+{
+	RLM3_FwCommand_Respond("pong");
+	return RLM3_FWCOMMAND_DONE;
+}
+
+static RLM3_FwCommand_Result LogStatusCommand(size_t argc, char** argv)
+{
+	RLM3_FwCommand_Respond("head %u tail %u", (unsigned)LOG_MEMORY->log_head, (unsigned)LOG_MEMORY->log_tail);
+	return RLM3_FWCOMMAND_DONE;
+}
+
+static void StoreLocked(size_t head, char c)
+{
+	g_buffer[head & (COMMAND_BUFFER_SIZE - 1)] = c;
+	g_head = head + 1;
+	if ((c == '\n' || c == COMMAND_CORRUPT_TERMINATOR) && g_dispatch_task != NULL)
+		RLM3_GiveFromISR(g_dispatch_task);
+}
+
+static bool PutCharLocked(char c)
+{
+	size_t head = g_head;
+	size_t available = COMMAND_BUFFER_SIZE - (head - g_tail);
+	bool is_terminator = (c == '\n' || c == '\r');
+
+	if (g_is_discarding)
+	{
+		// We lost part of the current frame.  Drop everything up to its end and then terminate it as corrupt.  If the
+		// terminator does not fit yet, it is written ahead of the next character so the following frame starts clean.
+		if (!is_terminator && !g_is_corrupt_terminator_pending)
+			return false;
+		if (available < 1)
+		{
+			// When a character of the next frame is lost as well, both frames end at the next terminator.
+			g_is_corrupt_terminator_pending = is_terminator;
+			return false;
+		}
+		StoreLocked(head++, COMMAND_CORRUPT_TERMINATOR);
+		available--;
+		g_is_discarding = false;
+		g_is_corrupt_terminator_pending = false;
+		if (is_terminator)
+			return true;
+	}
+
+	// Keep one slot free so a frame that overflows can still be terminated.  Only a terminator may use it, so a
+	// terminator that finds no room at all ends an empty frame and can be dropped.
+	if (available < (is_terminator ? 1 : 2))
+	{
+		g_is_discarding = !is_terminator;
+		return false;
+	}
+
+	StoreLocked(head, is_terminator ? '\n' : c);
+	return true;
+}
+
+static bool FindFrame(size_t* size_out, bool* is_corrupt_out)
+{
+	size_t head = g_head;
+	for (size_t i = g_scan; i != head; i++)
+	{
+		char c = g_buffer[i & (COMMAND_BUFFER_SIZE - 1)];
+		if (c == '\n' || c == COMMAND_CORRUPT_TERMINATOR)
+		{
+			*size_out = i + 1 - g_tail;
+			*is_corrupt_out = (c == COMMAND_CORRUPT_TERMINATOR);
+			g_scan = i + 1;
+			return true;
+		}
+	}
+	g_scan = head;
+	return false;
+}
+
+static void ParseFrame(size_t frame_size)
+{
+	// Tokenize the frame where it sits.  Only a frame that wraps the end of the buffer needs to be copied.
+	size_t start = g_tail & (COMMAND_BUFFER_SIZE - 1);
+	char* frame = g_buffer + start;
+	if (start + frame_size > COMMAND_BUFFER_SIZE)
+	{
+		size_t first = COMMAND_BUFFER_SIZE - start;
+		memcpy(g_scratch, g_buffer + start, first);
+		memcpy(g_scratch + first, g_buffer, frame_size - first);
+		frame = g_scratch;
+	}
+
+	g_argc = 0;
+	bool is_token = false;
+	for (size_t i = 0; i < frame_size; i++)
+	{
+		if (frame[i] == ' ' || frame[i] == '\n')
+		{
+			frame[i] = 0;
+			is_token = false;
+		}
+		else if (!is_token)
+		{
+			is_token = true;
+			if (g_argc < COMMAND_MAX_ARGS)
+				g_argv[g_argc] = frame + i;
+			g_argc++;
+		}
+	}
+}
+
+static RLM3_FwCommand_Result RunFrame()
+{
+	if (g_argc < 3 || g_argc > COMMAND_MAX_ARGS || strcmp(g_argv[0], "C") != 0)
+	{
+		RLM3_FwCommand_Respond("ERROR malformed");
+		return RLM3_FWCOMMAND_ERROR;
+	}
+
+	g_current_id = g_argv[1];
+	const char* name = g_argv[2];
+	for (size_t i = 0; i < g_handler_count; i++)
+		if (strcmp(g_handlers[i].name, name) == 0)
+			return g_handlers[i].handler(g_argc - 2, g_argv + 2);
+
+	RLM3_FwCommand_Respond("ERROR unknown '%s'", name);
+	return RLM3_FWCOMMAND_ERROR;
+}
+
+extern void RLM3_FwCommand_Init()
+{
+	ASSERT(!g_is_initialized);
+
+	g_head = 0;
+	g_tail = 0;
+	g_scan = 0;
+	g_is_discarding = false;
+	g_is_corrupt_terminator_pending = false;
+	g_is_frame_parsed = false;
+	g_current_id = NULL;
+	g_dispatch_task = NULL;
+	g_handler_count = 0;
+
+	g_is_initialized = true;
+
+	RLM3_FwCommand_Register("ping", PingCommand);
+	RLM3_FwCommand_Register("log-status", LogStatusCommand);
+}
+
+extern void RLM3_FwCommand_Deinit()
+{
+	ASSERT(g_is_initialized);
+
+	g_is_initialized = false;
+	g_dispatch_task = NULL;
+}
+
+extern bool RLM3_FwCommand_IsInit()
+{
+	return g_is_initialized;
+}
+
+extern bool RLM3_FwCommand_Register(const char* name, RLM3_FwCommand_Handler handler)
+{
+	ASSERT(g_is_initialized);
+	ASSERT(name != NULL && handler != NULL);
+
+	if (g_handler_count >= COMMAND_MAX_HANDLERS)
+		return false;
+	g_handlers[g_handler_count].name = name;
+	g_handlers[g_handler_count].handler = handler;
+	g_handler_count++;
+	return true;
+}
+
+extern bool RLM3_FwCommand_PutCharFromISR(char c)
+{
+	if (!g_is_initialized)
+		return false;
+
+	uint32_t saved_level = RLM3_EnterCriticalFromISR();
+	bool result = PutCharLocked(c);
+	RLM3_ExitCriticalFromISR(saved_level);
+	return result;
+}
+
+extern bool RLM3_FwCommand_PutFromISR(const char* data, size_t size)
+{
+	if (!g_is_initialized)
+		return false;
+
+	// Add the whole block at once so frames from different links are not interleaved.
+	bool result = true;
+	uint32_t saved_level = RLM3_EnterCriticalFromISR();
+	for (size_t i = 0; i < size; i++)
+		result &= PutCharLocked(data[i]);
+	RLM3_ExitCriticalFromISR(saved_level);
+	return result;
+}
+
+extern size_t RLM3_FwCommand_Dispatch()
+{
+	ASSERT(g_is_initialized);
+
+	g_dispatch_task = RLM3_GetCurrentTask();
+
+	size_t count = 0;
+	RLM3_Time dispatch_start = RLM3_GetCurrentTime();
+	while (count == 0 || RLM3_GetCurrentTime() - dispatch_start < DISPATCH_BUDGET_MS)
+	{
+		if (!g_is_frame_parsed)
+		{
+			bool is_corrupt;
+			if (!FindFrame(&g_frame_size, &is_corrupt))
+				break;
+			if (is_corrupt)
+			{
+				RLM3_FwCommand_Respond("ERROR overflow");
+				g_tail = g_tail + g_frame_size;
+				continue;
+			}
+			ParseFrame(g_frame_size);
+			g_is_frame_parsed = true;
+			if (g_argc == 0)
+			{
+				// Skip empty lines.
+				g_is_frame_parsed = false;
+				g_tail = g_tail + g_frame_size;
+				continue;
+			}
+		}
+
+		g_command_start = RLM3_GetCurrentTime();
+		RLM3_FwCommand_Result result = RunFrame();
+		RLM3_Time elapsed = RLM3_GetCurrentTime() - g_command_start;
+		if (elapsed > COMMAND_BUDGET_MS)
+			LOG_WARN("Command '%s' took %u ms", (g_argc >= 3) ? g_argv[2] : "-", (unsigned)elapsed);
+		g_current_id = NULL;
+		if (result == RLM3_FWCOMMAND_CONTINUE)
+			break;
+
+		// The frame is no longer needed, so the receive ISRs can reuse its space.
+		g_is_frame_parsed = false;
+		g_tail = g_tail + g_frame_size;
+		count++;
+	}
+	return count;
+}
+
+extern bool RLM3_FwCommand_IsOverBudget()
+{
+	return RLM3_GetCurrentTime() - g_command_start >= COMMAND_BUDGET_MS;
+}
+
+extern void RLM3_FwCommand_Respond(const char* format, ...)
+{
+	char response[COMMAND_MAX_RESPONSE];
+	va_list args;
+	va_start(args, format);
+	size_t size = RLM3_VFormatNoNul(response, sizeof(response) - 1, format, args);
+	va_end(args);
+	if (size > sizeof(response) - 1)
+		size = sizeof(response) - 1;
+	response[size] = 0;
+
+	RLM3_LogBuffer_FormatRawMessage("R %s %s", (g_current_id != NULL) ? g_current_id : "-", response);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "rlm3-base.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Commands arrive as newline terminated frames: "C <id> <name> [args...]\n".  Responses are written to the log as "R <id> <text>\n".
+typedef enum
+{
+	RLM3_FWCOMMAND_DONE,
+	RLM3_FWCOMMAND_CONTINUE, // The handler ran out of budget and wants to be called again with the same arguments.
+	RLM3_FWCOMMAND_ERROR,
+} RLM3_FwCommand_Result;
+
+typedef RLM3_FwCommand_Result (*RLM3_FwCommand_Handler)(size_t argc, char** argv);
+
+
+extern void RLM3_FwCommand_Init();
+extern void RLM3_FwCommand_Deinit();
+extern bool RLM3_FwCommand_IsInit();
+
+extern bool RLM3_FwCommand_Register(const char* name, RLM3_FwCommand_Handler handler);
+
+extern bool RLM3_FwCommand_PutCharFromISR(char c);
+extern bool RLM3_FwCommand_PutFromISR(const char* data, size_t size);
+
+extern size_t RLM3_FwCommand_Dispatch();
+extern bool RLM3_FwCommand_IsOverBudget();
+extern void RLM3_FwCommand_Respond(const char* format, ...) __attribute__ ((format (printf, 1, 2)));
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,50 +1,181 @@
 #include "rlm3-fw-communication.h"
 #include "rlm3-base.h"
 #include "rlm3-timer.h"
+#include "rlm3-timer-ext.h"
 #include "rlm3-log-buffer.h"
-#include "rlm3-settings.h"
+#include "rlm3-log-sink.h"
+#include "rlm3-fw-command.h"
+#include "Assert.h"
 
 
-static const size_t LOG_BUFFER_SIZE = sizeof(ExternalMemoryLayout::log_buffer);
+static const size_t DRAIN_TIMER_FREQUENCY = 10000;
+static const uint32_t DRAIN_PERIOD_US = 1000000 / DRAIN_TIMER_FREQUENCY;
+static const size_t DRAIN_MAX_BURST = 16;
+static const size_t DRAIN_BACKLOG_PER_BURST = 32; // Send one more character per interrupt for every this many characters waiting.
 
-static uint32_t g_debug_console_tail;
+static volatile bool g_is_initialized = false;
+static volatile bool g_is_debug_console = false;
+static volatile bool g_is_drain_armed = false;
+static volatile bool g_is_drain_throttled = false;
+static RLM3_LogSink g_debug_console_sink;
+static RLM3_LogSink_Filter g_debug_console_filter = { RLM3_LOGSINK_LEVEL_TRACE, NULL, 0, false, 0, 0 };
 
 
+static uint32_t EnterCritical()
+{
+	uint32_t result = 0;
+	if (RLM3_IsIRQ())
+		result = RLM3_EnterCriticalFromISR();
+	else
+		RLM3_EnterCritical();
+	return result;
+}
+
+static void ExitCritical(uint32_t saved_level)
+{
+	if (RLM3_IsIRQ())
+		RLM3_ExitCriticalFromISR(saved_level);
+	else
+		RLM3_ExitCritical();
+}
+
+static void SetDrainThrottledLocked(RLM3_Time wait)
+{
+	// Must be called from inside a critical section.  While the debug console waits for its rate budget, the next
+	// interrupt is held off until the budget has refilled.
+	g_is_drain_throttled = (wait != 0);
+	RLM3_Timer2_SetPeriod((wait != 0) ? wait * 1000 : DRAIN_PERIOD_US);
+}
+
+static void SetDrainArmedLocked(bool is_armed)
+{
+	// Must be called from inside a critical section.  The drain timer runs from Init to Deinit, and arming only switches
+	// its interrupt on and off.
+	g_is_drain_armed = is_armed;
+	if (g_is_drain_throttled)
+		SetDrainThrottledLocked(0);
+	if (is_armed)
+		RLM3_Timer2_EnableInterrupt();
+	else
+		RLM3_Timer2_DisableInterrupt();
+}
+
+extern void RLM3_LogBuffer_DataAvailable_Callback()
+{
+	// Arm the drain interrupt.  It disarms itself once the debug console has caught up.
+	if (!g_is_debug_console || g_is_drain_armed)
+		return;
+	uint32_t saved_level = EnterCritical();
+	if (g_is_debug_console)
+		SetDrainArmedLocked(true);
+	ExitCritical(saved_level);
+}
+
 extern void RLM3_Timer2_Event_Callback()
 {
-	// Make sure tail is still a valid reference.
-	if (g_debug_console_tail - EXTERNAL_MEMORY->log_tail > LOG_BUFFER_SIZE)
-	{
-		g_debug_console_tail = EXTERNAL_MEMORY->log_tail;
-	}
-	// Check if there is any data to send.
-	if (EXTERNAL_MEMORY->log_head - g_debug_console_tail > 0)
+	if (!g_is_drain_armed)
+		return;
+
+	// Send more characters per interrupt as the backlog grows.
+	uint32_t backlog = RLM3_LogSink_GetBacklog(&g_debug_console_sink);
+	size_t burst = 1 + backlog / DRAIN_BACKLOG_PER_BURST;
+	if (burst > DRAIN_MAX_BURST)
+		burst = DRAIN_MAX_BURST;
+	bool is_blocked = false;
+	while (burst > 0 && !is_blocked)
 	{
-		char c = EXTERNAL_MEMORY->log_buffer[g_debug_console_tail % LOG_BUFFER_SIZE];
-		if (RLM3_DebugOutputFromISR(c))
-			g_debug_console_tail++;
+		const char* data;
+		size_t size = RLM3_LogSink_Peek(&g_debug_console_sink, &data);
+		if (size == 0)
+			break;
+		size_t sent = 0;
+		while (sent < size && sent < burst && RLM3_DebugOutputFromISR(data[sent]))
+			sent++;
+		is_blocked = (sent < size && sent < burst);
+		RLM3_LogSink_Consume(&g_debug_console_sink, sent);
+		burst -= sent;
 	}
+	// Stop interrupting once there is nothing left to send.  New data will arm the interrupt again.
+	RLM3_Time wait = RLM3_LogSink_GetRateLimitWait(&g_debug_console_sink);
+	uint32_t saved_level = RLM3_EnterCriticalFromISR();
+	if (RLM3_LogSink_IsCaughtUp(&g_debug_console_sink))
+		SetDrainArmedLocked(false);
+	else if (wait != 0 || g_is_drain_throttled)
+		SetDrainThrottledLocked(wait);
+	RLM3_ExitCriticalFromISR(saved_level);
 }
 
 extern void RLM3_FwCommunication_Init()
 {
+	ASSERT(!g_is_initialized);
+
 	RLM3_LogBuffer_Init();
+	RLM3_FwCommand_Init();
 
 	if (RLM3_IsDebugOutput())
 	{
-		// When the debugger is connected, we use a timer interrupt to send logs messages to the debug console.
-		g_debug_console_tail = EXTERNAL_MEMORY->log_tail;
-		RLM3_Timer2_Init(10000);
+		// When the debugger is connected, we use a timer interrupt to send logs messages to the debug console.  The
+		// console shows names rather than interned ids.
+		RLM3_LogSink_Init(&g_debug_console_sink, &g_debug_console_filter);
+		RLM3_LogSink_SetExpanded(&g_debug_console_sink, true);
+		RLM3_Timer2_Init(DRAIN_TIMER_FREQUENCY);
+		RLM3_Timer2_SetPeriod(DRAIN_PERIOD_US);
+		uint32_t saved_level = EnterCritical();
+		SetDrainArmedLocked(false);
+		ExitCritical(saved_level);
+		g_is_debug_console = true;
+		if (!RLM3_LogSink_IsCaughtUp(&g_debug_console_sink))
+			RLM3_LogBuffer_DataAvailable_Callback();
 	}
 
-	// TODO: Start thread to connect to server and serve up a config page.
+	// TODO: Start thread to connect to server and serve up a config page.  It calls RLM3_FwCommand_Dispatch() for received commands.
 
+	g_is_initialized = true;
 }
 
 extern void RLM3_FwCommunication_Deinit()
 {
+	ASSERT(g_is_initialized);
+
+	uint32_t saved_level = EnterCritical();
+	g_is_debug_console = false;
+	if (g_is_drain_armed)
+		SetDrainArmedLocked(false);
+	ExitCritical(saved_level);
 	if (RLM3_Timer2_IsInit())
 		RLM3_Timer2_Deinit();
 
-	RLM3_LogBuffer_Deinit();
+	if (RLM3_FwCommand_IsInit())
+		RLM3_FwCommand_Deinit();
+	if (RLM3_LogBuffer_IsInit())
+		RLM3_LogBuffer_Deinit();
+
+	g_is_initialized = false;
+}
+
+extern bool RLM3_FwCommunication_IsInit()
+{
+	return g_is_initialized;
+}
+
+extern bool RLM3_FwCommunication_IsDrainArmed()
+{
+	return g_is_drain_armed;
+}
+
+extern bool RLM3_FwCommunication_IsDrainThrottled()
+{
+	return g_is_drain_throttled;
+}
+
+extern void RLM3_FwCommunication_SetDebugConsoleFilter(const RLM3_LogSink_Filter* filter)
+{
+	ASSERT(filter != NULL);
+
+	// Kept across restarts of the communication module.
+	uint32_t saved_level = EnterCritical();
+	g_debug_console_filter = *filter;
+	if (g_is_debug_console)
+		RLM3_LogSink_SetFilter(&g_debug_console_sink, filter);
+	ExitCritical(saved_level);
 }
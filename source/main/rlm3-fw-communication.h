@@ -1,6 +1,7 @@
 #pragma once
 
 #include "rlm3-base.h"
+#include "rlm3-log-sink.h"
 
 
 #ifdef __cplusplus
@@ -10,6 +11,15 @@ extern "C" {
 
 extern void RLM3_FwCommunication_Init();
 extern void RLM3_FwCommunication_Deinit();
+extern bool RLM3_FwCommunication_IsInit();
+
+// The debug console drain timer runs while the module is initialized, but its interrupt is only enabled while the
+// console has data to send.
+extern bool RLM3_FwCommunication_IsDrainArmed();
+// While the debug console waits for its rate budget, the drain interrupt is held off until the budget has refilled.
+extern bool RLM3_FwCommunication_IsDrainThrottled();
+
+extern void RLM3_FwCommunication_SetDebugConsoleFilter(const RLM3_LogSink_Filter* filter);
 
 
 #ifdef __cplusplus
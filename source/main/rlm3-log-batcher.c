@@ -0,0 +1,336 @@
+#include "rlm3-log-batcher.h"
+#include "rlm3-log-buffer.h"
+#include "Assert.h"
+#include "rlm3-base.h"
+#include "rlm3-settings.h"
+#include "rlm3-task.h"
+#include <string.h>
+
+
+static const size_t BUFFER_SIZE = sizeof(ExternalMemoryLayout::log_buffer);
+static const size_t BUFFER_MASK = BUFFER_SIZE - 1;
+
+static const size_t MIN_BATCH_SIZE = 64;
+static const size_t MAX_BATCH_SIZE = 4096;
+static const RLM3_Time LATENCY_TARGET_MS = 250; // Goal for the time from publishing a record to its acknowledgement.
+static const RLM3_Time MIN_DELAY_MS = 5;
+static const RLM3_Time INITIAL_RTT_MS = 50;
+static const uint32_t INITIAL_THROUGHPUT = 10000;
+
+
+static char GetChar(uint32_t position)
+{
+	return LOG_MEMORY->log_buffer[position & BUFFER_MASK];
+}
+
+static bool IsUrgentRecord(uint32_t position, uint32_t head)
+{
+	// Log records look like "L <time> <level> <zone> <message>", or "l <time> <level_id> <zone_id> <message>" when the
+	// names are interned.
+	if (head - position < 2 || (GetChar(position) != 'L' && GetChar(position) != 'l') || GetChar(position + 1) != ' ')
+		return false;
+	bool is_interned = (GetChar(position) == 'l');
+	position += 2;
+	while (position != head && GetChar(position) >= '0' && GetChar(position) <= '9')
+		position++;
+	if (position == head || GetChar(position) != ' ')
+		return false;
+	position++;
+	static const char* const URGENT_LEVELS[] = { "ERROR", "FATAL" };
+	if (is_interned)
+	{
+		// Ids from an earlier session cannot be looked up.
+		if (!RLM3_LogBuffer_IsCurrentSession(position))
+			return false;
+		uint32_t id = 0;
+		while (position != head && GetChar(position) >= '0' && GetChar(position) <= '9')
+			id = 10 * id + (GetChar(position++) - '0');
+		const char* level = RLM3_LogBuffer_GetInternName(id);
+		for (size_t i = 0; i < sizeof(URGENT_LEVELS) / sizeof(URGENT_LEVELS[0]); i++)
+			if (level != NULL && strcmp(level, URGENT_LEVELS[i]) == 0)
+				return true;
+		return false;
+	}
+	for (size_t j = 0; j < sizeof(URGENT_LEVELS) / sizeof(URGENT_LEVELS[0]); j++)
+	{
+		const char* level = URGENT_LEVELS[j];
+		size_t i = 0;
+		while (level[i] != 0 && position + i != head && GetChar(position + i) == level[i])
+			i++;
+		if (level[i] == 0 && position + i != head && GetChar(position + i) == ' ')
+			return true;
+	}
+	return false;
+}
+
+static RLM3_Time GetOldestRecordTime(const RLM3_LogBatcher* batcher, uint32_t position, uint32_t head, RLM3_Time now)
+{
+	// Log records carry the time they were written.  Other records have no time, so they are treated as waiting since
+	// the last batch was sent.  Nothing left can have waited longer than the data that was pending before it.
+	RLM3_Time time = batcher->in_flight_time;
+	if (head - position >= 2 && (GetChar(position) == 'L' || GetChar(position) == 'l') && GetChar(position + 1) == ' ')
+	{
+		uint32_t value = 0;
+		uint32_t start = position + 2;
+		for (position = start; position != head && GetChar(position) >= '0' && GetChar(position) <= '9'; position++)
+			value = 10 * value + (GetChar(position) - '0');
+		if (position != start && position != head && GetChar(position) == ' ')
+			time = value;
+	}
+	if (now - time > now - batcher->pending_time)
+		time = batcher->pending_time;
+	return time;
+}
+
+static void ScanNewRecords(RLM3_LogBatcher* batcher, uint32_t head)
+{
+	// The published head is always at the end of a record, so the scan position is always at the start of one.
+	uint32_t position = batcher->scan_position;
+	while (position != head)
+	{
+		if (IsUrgentRecord(position, head))
+			batcher->is_urgent = true;
+		while (position != head && GetChar(position) != '\n')
+			position++;
+		if (position != head)
+			position++;
+	}
+	batcher->scan_position = position;
+}
+
+static void UpdateKnobs(RLM3_LogBatcher* batcher)
+{
+	// Coalesce about twice the bandwidth delay product so the link spends most of its time sending, not waiting.
+	uint64_t target_size = 2 * (uint64_t)batcher->smoothed_throughput * batcher->min_rtt / 1000;
+	if (target_size < MIN_BATCH_SIZE)
+		target_size = MIN_BATCH_SIZE;
+	if (target_size > MAX_BATCH_SIZE)
+		target_size = MAX_BATCH_SIZE;
+	batcher->target_size = (size_t)target_size;
+
+	// Leave room in the latency target for the batch to make it across the link.
+	RLM3_Time transfer_time = (RLM3_Time)(1000 * (uint64_t)batcher->target_size / batcher->smoothed_throughput);
+	RLM3_Time delivery_time = batcher->smoothed_rtt + transfer_time;
+	batcher->max_delay = (delivery_time + MIN_DELAY_MS < LATENCY_TARGET_MS) ? LATENCY_TARGET_MS - delivery_time : MIN_DELAY_MS;
+}
+
+extern void RLM3_LogBatcher_Init(RLM3_LogBatcher* batcher, const RLM3_LogSink_Filter* filter)
+{
+	ASSERT(batcher != NULL && filter != NULL);
+	ASSERT(RLM3_LogBuffer_IsInit());
+
+	memset(batcher, 0, sizeof(*batcher));
+	RLM3_LogSink_Init(&batcher->sink, filter);
+	RLM3_LogSink_SetRetaining(&batcher->sink, true);
+	batcher->min_rtt = INITIAL_RTT_MS;
+	batcher->smoothed_rtt = INITIAL_RTT_MS;
+	batcher->smoothed_throughput = INITIAL_THROUGHPUT;
+	batcher->scan_position = batcher->sink.cursor;
+	UpdateKnobs(batcher);
+}
+
+extern void RLM3_LogBatcher_Deinit(RLM3_LogBatcher* batcher)
+{
+	ASSERT(batcher != NULL);
+
+	RLM3_LogSink_SetRetaining(&batcher->sink, false);
+}
+
+extern void RLM3_LogBatcher_SetFilter(RLM3_LogBatcher* batcher, const RLM3_LogSink_Filter* filter)
+{
+	ASSERT(batcher != NULL && filter != NULL);
+	ASSERT(!batcher->is_in_flight);
+
+	RLM3_LogSink_SetFilter(&batcher->sink, filter);
+}
+
+static size_t FindNewline(const char* data, size_t size, bool is_last)
+{
+	// Returns the size up to and including the first or last newline, or 0 if there is none.
+	for (size_t i = 0; i < size; i++)
+	{
+		size_t index = is_last ? size - i - 1 : i;
+		if (data[index] == '\n')
+			return index + 1;
+	}
+	return 0;
+}
+
+static size_t PeekBatch(RLM3_LogBatcher* batcher, const char** data_out)
+{
+	// Batches hold whole records up to the target size, or a single record that is bigger than it.
+	size_t room = (batcher->in_flight_size < batcher->target_size) ? batcher->target_size - batcher->in_flight_size : 0;
+	if (room == 0 && !batcher->is_mid_record)
+		return 0;
+	size_t size = RLM3_LogSink_Peek(&batcher->sink, data_out);
+	if (size > room)
+	{
+		// Without a filter the sink hands out many records at once, so they are cut at the last one that fits.
+		size_t cut_size = FindNewline(*data_out, room, true);
+		if (cut_size == 0 && (batcher->is_mid_record || batcher->in_flight_size == 0))
+			cut_size = FindNewline(*data_out, size, false);
+		if (cut_size == 0 && (batcher->is_mid_record || batcher->in_flight_size == 0))
+			cut_size = size;
+		size = cut_size;
+	}
+	return size;
+}
+
+extern bool RLM3_LogBatcher_Poll(RLM3_LogBatcher* batcher)
+{
+	ASSERT(batcher != NULL);
+
+	if (batcher->is_in_flight)
+		return false;
+
+	RLM3_Time now = RLM3_GetCurrentTime();
+	uint32_t backlog = RLM3_LogSink_GetBacklog(&batcher->sink);
+	uint32_t cursor = batcher->sink.cursor;
+	uint32_t head = cursor + backlog;
+
+	// The sink may have skipped past what we scanned.
+	if (batcher->scan_position - cursor > head - cursor)
+		batcher->scan_position = cursor;
+	ScanNewRecords(batcher, head);
+
+	if (backlog == 0)
+	{
+		batcher->is_pending = false;
+		batcher->is_urgent = false;
+		return false;
+	}
+	if (!batcher->is_pending)
+	{
+		batcher->is_pending = true;
+		batcher->pending_time = now;
+	}
+
+	bool is_full = (backlog >= batcher->target_size);
+	bool is_late = (now - batcher->pending_time >= batcher->max_delay);
+	if (!is_full && !is_late && !batcher->is_urgent)
+		return false;
+
+	batcher->batch_sink = batcher->sink;
+	batcher->is_in_flight = true;
+	batcher->is_batch_read = false;
+	batcher->is_mid_record = false;
+	batcher->peek_size = 0;
+	batcher->in_flight_size = 0;
+	batcher->in_flight_time = now;
+	const char* data;
+	if (RLM3_LogBatcher_Peek(batcher, &data) != 0)
+		return true;
+
+	// Nothing can go out yet.  Whatever the filter skipped is given back, and the rest is waiting for tokens.
+	batcher->is_in_flight = false;
+	RLM3_LogSink_Release(&batcher->sink, batcher->in_flight_end);
+	if (RLM3_LogSink_IsCaughtUp(&batcher->sink))
+	{
+		batcher->is_pending = false;
+		batcher->is_urgent = false;
+	}
+	return false;
+}
+
+extern size_t RLM3_LogBatcher_Peek(RLM3_LogBatcher* batcher, const char** data_out)
+{
+	ASSERT(batcher != NULL && data_out != NULL);
+	ASSERT(batcher->is_in_flight);
+
+	if (batcher->is_batch_read)
+		return 0;
+	size_t size = PeekBatch(batcher, data_out);
+	batcher->peek_data = *data_out;
+	batcher->peek_size = size;
+	if (size == 0)
+	{
+		batcher->is_batch_read = true;
+		batcher->in_flight_end = batcher->sink.cursor;
+	}
+	return size;
+}
+
+extern void RLM3_LogBatcher_Consume(RLM3_LogBatcher* batcher, size_t size)
+{
+	ASSERT(batcher != NULL);
+	ASSERT(batcher->is_in_flight);
+	ASSERT(size <= batcher->peek_size);
+
+	if (size == 0)
+		return;
+	RLM3_LogSink_Consume(&batcher->sink, size);
+	batcher->is_mid_record = (batcher->peek_data[size - 1] != '\n');
+	batcher->in_flight_size += size;
+	batcher->peek_size = 0;
+}
+
+extern void RLM3_LogBatcher_Acknowledge(RLM3_LogBatcher* batcher)
+{
+	ASSERT(batcher != NULL);
+	ASSERT(batcher->is_in_flight && batcher->is_batch_read);
+
+	RLM3_Time now = RLM3_GetCurrentTime();
+	uint32_t start = batcher->batch_sink.cursor;
+	size_t size = batcher->in_flight_size;
+
+	// Release the data and figure out what is still waiting.
+	if (batcher->in_flight_end - start >= batcher->scan_position - start)
+		batcher->is_urgent = false;
+	RLM3_LogSink_Release(&batcher->sink, batcher->in_flight_end);
+	batcher->is_in_flight = false;
+	uint32_t head = LOG_MEMORY->log_head;
+	if (head == batcher->in_flight_end)
+		batcher->is_pending = false;
+	else
+		batcher->pending_time = GetOldestRecordTime(batcher, batcher->in_flight_end, head, now);
+
+	// The smallest round trip is the link latency and anything above it is the time to transfer the data.
+	RLM3_Time rtt = now - batcher->in_flight_time;
+	if (rtt == 0)
+		rtt = 1;
+	if (!batcher->is_rtt_measured)
+	{
+		// The initial guess must not hold the minimum below what the link can actually do.
+		batcher->is_rtt_measured = true;
+		batcher->min_rtt = rtt;
+		batcher->smoothed_rtt = rtt;
+	}
+	if (rtt < batcher->min_rtt)
+		batcher->min_rtt = rtt;
+	batcher->smoothed_rtt = (7 * batcher->smoothed_rtt + rtt) / 8;
+	if (rtt > batcher->min_rtt)
+	{
+		uint64_t throughput = 1000 * (uint64_t)size / (rtt - batcher->min_rtt);
+		throughput = (7 * (uint64_t)batcher->smoothed_throughput + throughput) / 8;
+		if (throughput > UINT32_MAX)
+			throughput = UINT32_MAX;
+		batcher->smoothed_throughput = (throughput != 0) ? (uint32_t)throughput : 1;
+	}
+	UpdateKnobs(batcher);
+}
+
+extern void RLM3_LogBatcher_Abort(RLM3_LogBatcher* batcher)
+{
+	ASSERT(batcher != NULL);
+	ASSERT(batcher->is_in_flight);
+
+	// The same data is sent again on the next poll.
+	batcher->sink = batcher->batch_sink;
+	batcher->is_in_flight = false;
+}
+
+extern RLM3_Time RLM3_LogBatcher_GetWaitTime(const RLM3_LogBatcher* batcher)
+{
+	ASSERT(batcher != NULL);
+
+	if (batcher->is_in_flight || !batcher->is_pending)
+		return batcher->max_delay;
+
+	// Records waiting for tokens cannot go out sooner, even when they are urgent.
+	RLM3_Time wait = 0;
+	RLM3_Time age = RLM3_GetCurrentTime() - batcher->pending_time;
+	if (!batcher->is_urgent && age < batcher->max_delay)
+		wait = batcher->max_delay - age;
+	RLM3_Time rate_limit_wait = RLM3_LogSink_GetRateLimitWait(&batcher->sink);
+	return (wait > rate_limit_wait) ? wait : rate_limit_wait;
+}
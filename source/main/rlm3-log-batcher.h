@@ -0,0 +1,62 @@
+#pragma once
+
+#include "rlm3-base.h"
+#include "rlm3-log-sink.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Decides when the comm task sends log data over a link.  Data is coalesced up to a size target, but sent early when
+// the oldest unsent data reaches a latency deadline or when an ERROR or FATAL record arrives.  Both knobs are adjusted
+// from the round trip time and throughput measured on acknowledged batches.  The batcher reads through a retaining sink
+// with the uplink's own filter and rate limit, and batches hold whole records.  Only one batch is in flight at a time
+// and its data is released when it is acknowledged.  The batcher must stay in place between Init and Deinit.
+typedef struct
+{
+	RLM3_LogSink sink;
+	RLM3_LogSink batch_sink; // The sink as it was when the batch in flight started, so an abort can send it again.
+
+	size_t target_size;
+	RLM3_Time max_delay;
+
+	bool is_rtt_measured;
+	RLM3_Time min_rtt;
+	RLM3_Time smoothed_rtt;
+	uint32_t smoothed_throughput; // Bytes per second, not counting the round trip time.
+
+	uint32_t scan_position;
+	bool is_urgent;
+	bool is_pending;
+	RLM3_Time pending_time;
+
+	bool is_in_flight;
+	bool is_batch_read; // Peek has reached the end of the batch in flight.
+	bool is_mid_record; // The data consumed so far ends part way through a record.
+	const char* peek_data;
+	size_t peek_size;
+	size_t in_flight_size;
+	uint32_t in_flight_end;
+	RLM3_Time in_flight_time;
+} RLM3_LogBatcher;
+
+
+extern void RLM3_LogBatcher_Init(RLM3_LogBatcher* batcher, const RLM3_LogSink_Filter* filter);
+extern void RLM3_LogBatcher_Deinit(RLM3_LogBatcher* batcher);
+extern void RLM3_LogBatcher_SetFilter(RLM3_LogBatcher* batcher, const RLM3_LogSink_Filter* filter);
+
+// Poll starts a batch when one is due.  Its data is then read with Peek and Consume until Peek returns 0, and the batch
+// is finished with Acknowledge once the link has delivered it, or with Abort to send the same data again.
+extern bool RLM3_LogBatcher_Poll(RLM3_LogBatcher* batcher);
+extern size_t RLM3_LogBatcher_Peek(RLM3_LogBatcher* batcher, const char** data_out);
+extern void RLM3_LogBatcher_Consume(RLM3_LogBatcher* batcher, size_t size);
+extern void RLM3_LogBatcher_Acknowledge(RLM3_LogBatcher* batcher);
+extern void RLM3_LogBatcher_Abort(RLM3_LogBatcher* batcher);
+extern RLM3_Time RLM3_LogBatcher_GetWaitTime(const RLM3_LogBatcher* batcher);
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -7,13 +7,32 @@
 #include "rlm3-lock.h"
 #include "rlm3-string.h"
 #include <string.h>
+#include <stddef.h>
+#if defined(RLM3_LOG_BUFFER_PROFILE) && defined(TEST)
+#include <time.h>
+#elif defined(RLM3_LOG_BUFFER_PROFILE)
+#include "stm32f4xx.h"
+#endif
 
 
 #define LOG_MAGIC (0x4C4F474D) // 'LOGM'
 #define FAULT_MAGIC (0x464F554C) // 'FOUL'
+#define SNAPSHOT_MAGIC (0x4C534E50) // 'LSNP'
+#define SNAPSHOT_VERSION (2)
 
 static const size_t BUFFER_SIZE = sizeof(ExternalMemoryLayout::log_buffer);
+static const size_t BUFFER_MASK = BUFFER_SIZE - 1;
 static const size_t FULL_BUFFER_RESTART_LIMIT = BUFFER_SIZE / 2;
+static const size_t RECORDER_SIZE = 64; // Must be a power of 2.
+static const size_t INTERN_SIZE = 64;
+static const size_t INTERN_SLOT_COUNT = 128; // Must be a power of 2.
+static const size_t INTERN_MAX_NAME_SIZE = 32;
+static const uint8_t INTERN_NONE = 0xFF;
+static const size_t STAGING_SIZE = 1024;
+static const size_t INTERN_RECORD_SIZE = INTERN_MAX_NAME_SIZE + 6; // "I <id> <name>\n"
+
+
+static_assert((BUFFER_SIZE & BUFFER_MASK) == 0, "The log buffer size must be a power of 2.");
 
 
 LOGGER_ZONE(LOG_BUFFER);
@@ -25,58 +44,219 @@ static volatile bool g_is_overflow = false;
 static volatile size_t g_log_allocation_head;
 static volatile size_t g_active_logger_count = 0;
 
-static const char* g_debug_channel = NULL;
+static const volatile uint32_t* g_retainers[RLM3_LOGBUFFER_MAX_RETAINERS];
+
+// The last record is a debug line that more characters can be added to.  Callers may reuse the buffer that holds the
+// channel name, so the channel is matched against its interned name, or the copy in the log when it has no id.
+static bool g_is_debug_channel_open = false;
+static uint8_t g_debug_channel_id;
+static uint32_t g_debug_channel_name; // Where the name is in the log when it has no id.
+static size_t g_debug_channel_size;
+static RLM3_LogBufferStats g_stats;
+
+typedef struct
+{
+	RLM3_LogSnapshotHeader header;
+	char fault_cause[sizeof(ExternalMemoryLayout::fault_cause)];
+	char fault_communication_thread_state[sizeof(ExternalMemoryLayout::fault_communication_thread_state)];
+} SnapshotPrefix;
+
+static volatile bool g_is_snapshot_active = false;
+static volatile uint32_t g_snapshot_cursor; // Data at or after this position is still needed by the snapshot.
+static uint32_t g_snapshot_chunk_end; // The end of the chunk the caller is still sending.
+static uint32_t g_snapshot_end;
+static bool g_is_snapshot_prefix_sent;
+static SnapshotPrefix g_snapshot_prefix;
+static size_t g_snapshot_intern_count; // The ids in the snapshot's intern table.
+static size_t g_snapshot_intern_index; // The next id to send.
+static char g_snapshot_intern_record[INTERN_RECORD_SIZE];
+
+typedef struct
+{
+	RLM3_Time time;
+	const char* level;
+	const char* zone;
+	const char* format;
+	uint32_t args[RLM3_LOG_RECORDER_ARG_COUNT];
+} RecorderEntry;
+
+static RecorderEntry g_recorder[RECORDER_SIZE];
+static volatile uint32_t g_recorder_head = 0;
+static volatile uint32_t g_recorder_tail = 0;
+static volatile bool g_is_recorder_flush_pending = false; // An ERROR in an ISR left the flush to the next task.
+
+// Names are copied into the table and found by hash without locking.  A slot's name and id are written before its
+// hash, so a reader that sees the hash also sees the rest.
+typedef struct
+{
+	volatile uint32_t hash; // 0 for an empty slot.
+	uint8_t id;
+} InternSlot;
+
+static InternSlot g_intern_slots[INTERN_SLOT_COUNT];
+static char g_intern_names[INTERN_SIZE][INTERN_MAX_NAME_SIZE + 1];
+static volatile size_t g_intern_count;
+static bool g_is_intern_written[INTERN_SIZE]; // The definition has been written to the log in this session.
+static uint32_t g_intern_position[INTERN_SIZE]; // Where the definition was last written.
+static uint32_t g_session_start; // Ids in records before this position belong to an earlier session.
+
+// Records written before Init, in the order they were written.  Init copies them into the log.
+static char g_staging[STAGING_SIZE];
+static volatile size_t g_staging_size = 0;
+static volatile size_t g_staging_dropped_size = 0;
+static bool g_is_staging_channel_open = false; // The same as g_is_debug_channel_open, for the staging buffer.
+static size_t g_staging_channel_name;
+static size_t g_staging_channel_size;
 
 
 static void FormatToBufferFn(void* data, char c)
 {
 	size_t* cursor = (size_t*)data;
-	EXTERNAL_MEMORY->log_buffer[(*cursor)++ % BUFFER_SIZE] = c;
+	LOG_MEMORY->log_buffer[(*cursor)++ & BUFFER_MASK] = c;
+}
+
+static void WriteToBuffer(size_t* cursor, const char* data, size_t size)
+{
+	// A span is copied in at most two pieces, one on each side of the end of the ring.
+	size_t offset = *cursor & BUFFER_MASK;
+	size_t first_size = BUFFER_SIZE - offset;
+	if (first_size > size)
+		first_size = size;
+	memcpy(LOG_MEMORY->log_buffer + offset, data, first_size);
+	memcpy(LOG_MEMORY->log_buffer, data + first_size, size - first_size);
+	*cursor += size;
 }
 
-static void FormatToDebugOutput(void* data, char c)
+static void VFormatToBuffer(size_t* cursor, size_t size, const char* format, va_list params)
 {
-	RLM3_DebugOutput(c);
+	// The output is formatted straight into the ring unless it crosses the end, which only happens once per lap.  The
+	// size must be the exact size of the output.
+	size_t offset = *cursor & BUFFER_MASK;
+	if (size <= BUFFER_SIZE - offset)
+	{
+		RLM3_VFormatNoNul(LOG_MEMORY->log_buffer + offset, size, format, params);
+		*cursor += size;
+	}
+	else
+		RLM3_FnVFormat(FormatToBufferFn, cursor, format, params);
 }
 
-static uint32_t EnterCritical()
+static void FormatToBuffer(size_t* cursor, size_t size, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	VFormatToBuffer(cursor, size, format, args);
+	va_end(args);
+}
+
+#ifdef RLM3_LOG_BUFFER_PROFILE
+static RLM3_LogBuffer_Profile g_profile;
+static uint32_t g_profile_start; // Critical sections in this module never nest.
+static RLM3_LogBuffer_ProfileSite g_profile_site;
+
+static const char* const PROFILE_SITE_NAMES[RLM3_LOGBUFFER_SITE_COUNT] = {
+	"BeginOutputToBuffer",
+	"EndOutputToBuffer",
+	"DebugChar",
+	"Record",
+	"FlushRecorder",
+	"BeginSnapshot",
+	"GetStats",
+	"Intern",
+	"CopyStaging",
+};
+
+static void EndProfile()
+{
+	// Still inside the critical section, so the profile can be updated directly.
+	uint32_t duration = RLM3_LogBuffer_GetCycleCount() - g_profile_start;
+	RLM3_LogBuffer_ProfileSiteStats* stats = &g_profile.sites[g_profile_site];
+	size_t bucket = 0;
+	while (bucket + 1 < RLM3_LOGBUFFER_PROFILE_BUCKET_COUNT && (duration >> bucket) > 1)
+		bucket++;
+	stats->histogram[bucket]++;
+	stats->count++;
+	stats->total += duration;
+	if (duration > stats->max)
+		stats->max = duration;
+	if (duration > g_profile.worst)
+	{
+		g_profile.worst = duration;
+		g_profile.worst_site = g_profile_site;
+	}
+}
+#endif
+
+static uint32_t EnterCritical(RLM3_LogBuffer_ProfileSite site)
 {
 	uint32_t result = 0;
 	if (RLM3_IsIRQ())
 		result = RLM3_EnterCriticalFromISR();
 	else
 		RLM3_EnterCritical();
+#ifdef RLM3_LOG_BUFFER_PROFILE
+	g_profile_site = site;
+	g_profile_start = RLM3_LogBuffer_GetCycleCount();
+#endif
 	return result;
 }
 
 static void ExitCritical(uint32_t saved_level)
 {
+#ifdef RLM3_LOG_BUFFER_PROFILE
+	EndProfile();
+#endif
 	if (RLM3_IsIRQ())
 		RLM3_ExitCriticalFromISR(saved_level);
 	else
 		RLM3_ExitCritical();
 }
 
+static size_t GetAvailableSize(ExternalMemoryLayout* external_memory)
+{
+	// An active snapshot keeps its data from being overwritten even if the consumer has already moved past it.
+	uint32_t tail = external_memory->log_tail;
+	if (g_is_snapshot_active && g_log_allocation_head - g_snapshot_cursor > g_log_allocation_head - tail)
+		tail = g_snapshot_cursor;
+	return BUFFER_SIZE - (g_log_allocation_head - tail);
+}
+
+static void UpdateStats(ExternalMemoryLayout* external_memory, bool is_written, size_t size)
+{
+	// Must be called from inside a critical section.
+	if (is_written)
+	{
+		g_stats.written_bytes += size;
+		size_t used_size = g_log_allocation_head - external_memory->log_tail;
+		if (used_size > g_stats.peak_used_size)
+			g_stats.peak_used_size = used_size;
+	}
+	else
+		g_stats.dropped_bytes += size;
+}
+
 static bool BeginOutputToBuffer(size_t size, size_t* offset_out)
 {
-	ExternalMemoryLayout* external_memory = (ExternalMemoryLayout*)RLM3_EXTERNAL_MEMORY_ADDRESS;
+	ExternalMemoryLayout* external_memory = LOG_MEMORY;
 
 	bool result = false;
-	uint32_t saved_level = EnterCritical();
-	size_t available_size = BUFFER_SIZE - (g_log_allocation_head - external_memory->log_tail);
-	if (size > available_size)
+	uint32_t saved_level = EnterCritical(RLM3_LOGBUFFER_SITE_BEGIN_OUTPUT);
+	size_t available_size = GetAvailableSize(external_memory);
+	if (size > available_size && !g_is_overflow)
 	{
 		g_is_overflow = true;
+		g_stats.overflow_count++;
 	}
-	else if (!g_is_overflow)
+	if (!g_is_overflow)
 	{
 		size_t head = g_log_allocation_head;
 		*offset_out = head;
 		g_log_allocation_head = head + size;
-		g_debug_channel = NULL;
+		g_is_debug_channel_open = false;
 		g_active_logger_count++;
 		result = true;
 	}
+	UpdateStats(external_memory, result, size);
 	ExitCritical(saved_level);
 	return result;
 }
@@ -85,13 +265,311 @@ static void EndOutputToBuffer()
 {
 	ASSERT(g_active_logger_count != 0);
 
-	ExternalMemoryLayout* external_memory = (ExternalMemoryLayout*)RLM3_EXTERNAL_MEMORY_ADDRESS;
+	ExternalMemoryLayout* external_memory = LOG_MEMORY;
 
-	uint32_t saved_level = EnterCritical();
+	bool is_published = false;
+	uint32_t saved_level = EnterCritical(RLM3_LOGBUFFER_SITE_END_OUTPUT);
 	if (--g_active_logger_count == 0)
+	{
 		external_memory->log_head = g_log_allocation_head;
-	g_debug_channel = NULL;
+		is_published = true;
+	}
+	g_is_debug_channel_open = false;
+	ExitCritical(saved_level);
+
+	if (is_published)
+		RLM3_LogBuffer_DataAvailable_Callback();
+}
+
+static uint32_t HashInternName(const char* name)
+{
+	// FNV-1a, or 0 for names that cannot be interned: empty, too long, or with spaces or unprintable characters.
+	uint32_t hash = 2166136261u;
+	size_t size = 0;
+	for (; name[size] != 0; size++)
+	{
+		if (name[size] <= ' ' || name[size] > '~' || size == INTERN_MAX_NAME_SIZE)
+			return 0;
+		hash = (hash ^ (uint8_t)name[size]) * 16777619u;
+	}
+	if (size == 0)
+		return 0;
+	return (hash != 0) ? hash : 1;
+}
+
+static size_t FindInternSlot(const char* name, uint32_t hash)
+{
+	// Returns the slot holding this name, or the empty slot where it would go.  The slots are never more than half full.
+	size_t i = hash & (INTERN_SLOT_COUNT - 1);
+	while (g_intern_slots[i].hash != 0 && (g_intern_slots[i].hash != hash || strcmp(g_intern_names[g_intern_slots[i].id], name) != 0))
+		i = (i + 1) & (INTERN_SLOT_COUNT - 1);
+	return i;
+}
+
+static uint8_t InternLocked(const char* name, uint32_t hash)
+{
+	// Must be called from inside a critical section.
+	if (hash == 0)
+		return INTERN_NONE;
+	size_t slot = FindInternSlot(name, hash);
+	if (g_intern_slots[slot].hash != 0)
+		return g_intern_slots[slot].id;
+	size_t count = g_intern_count;
+	if (count == INTERN_SIZE)
+		return INTERN_NONE;
+
+	strcpy(g_intern_names[count], name); // The hash checked the size.
+	g_is_intern_written[count] = false;
+	g_intern_slots[slot].id = (uint8_t)count;
+	g_intern_slots[slot].hash = hash;
+	g_intern_count = count + 1;
+	return (uint8_t)count;
+}
+
+static uint8_t Intern(const char* name)
+{
+	// Names already in the table are found without locking.
+	uint32_t hash = HashInternName(name);
+	if (hash == 0)
+		return INTERN_NONE;
+	size_t slot = FindInternSlot(name, hash);
+	if (g_intern_slots[slot].hash != 0)
+		return g_intern_slots[slot].id;
+	if (g_intern_count == INTERN_SIZE)
+		return INTERN_NONE;
+
+	uint32_t saved_level = EnterCritical(RLM3_LOGBUFFER_SITE_INTERN);
+	uint8_t id = InternLocked(name, hash);
+	ExitCritical(saved_level);
+	return id;
+}
+
+static size_t FormatNumber(char* buffer, uint32_t value)
+{
+	char digits[10];
+	size_t count = 0;
+	do
+	{
+		digits[count++] = '0' + value % 10;
+		value /= 10;
+	} while (value != 0);
+	for (size_t i = 0; i < count; i++)
+		buffer[i] = digits[count - i - 1];
+	return count;
+}
+
+static size_t FormatInternRecord(char* buffer, uint8_t id)
+{
+	// Output: "I ID NAME\n"
+	size_t size = 0;
+	buffer[size++] = 'I';
+	buffer[size++] = ' ';
+	size += FormatNumber(buffer + size, id);
+	buffer[size++] = ' ';
+	for (const char* name = g_intern_names[id]; *name != 0; name++)
+		buffer[size++] = *name;
+	buffer[size++] = '\n';
+	return size;
+}
+
+static bool IsInternWritten(uint8_t id)
+{
+	// Released data stays in the ring until it is written over, so a dump can still find definitions behind log_tail.
+	// Once the log has moved half the ring past a definition it is written again, before it can be lost.
+	return g_is_intern_written[id] && g_log_allocation_head - g_intern_position[id] < BUFFER_SIZE / 2;
+}
+
+static void SetInternWritten(uint8_t id, uint32_t position)
+{
+	g_intern_position[id] = position;
+	g_is_intern_written[id] = true;
+}
+
+static void WriteLogRecord(RLM3_Time time, const char* level, const char* zone, const char* format, va_list params)
+{
+	bool is_irq = RLM3_IsIRQ();
+
+	// Interned records carry ids instead of names: "l <time> <level_id> <zone_id> <message>".  Any id that has not been
+	// defined yet this session is defined in front of the record.  If either name cannot be interned, both are written out.
+	uint8_t level_id = Intern(level);
+	uint8_t zone_id = Intern(zone);
+	bool is_interned = (level_id != INTERN_NONE && zone_id != INTERN_NONE);
+	bool is_level_defined = is_interned && !IsInternWritten(level_id);
+	bool is_zone_defined = is_interned && zone_id != level_id && !IsInternWritten(zone_id);
+
+	char header[2 * INTERN_RECORD_SIZE + 20];
+	size_t header_size = 0;
+	size_t level_definition_size = 0;
+	if (is_interned)
+	{
+		if (is_level_defined)
+			header_size += level_definition_size = FormatInternRecord(header + header_size, level_id);
+		if (is_zone_defined)
+			header_size += FormatInternRecord(header + header_size, zone_id);
+		header[header_size++] = 'l';
+		header[header_size++] = ' ';
+		header_size += FormatNumber(header + header_size, (uint32_t)time);
+		header[header_size++] = ' ';
+		header_size += FormatNumber(header + header_size, level_id);
+		header[header_size++] = ' ';
+		header_size += FormatNumber(header + header_size, zone_id);
+		header[header_size++] = ' ';
+	}
+	else
+		header_size = RLM3_FormatNoNul(NULL, 0, "L %u %s %s ", (int)time, level, zone);
+
+	// Determine the size of this log message.
+	va_list args;
+	va_copy(args, params);
+	size_t content_size = RLM3_VFormatNoNul(NULL, 0, format, args);
+	size_t total_size = header_size + content_size + 1;
+	va_end(args);
+
+	if (!is_irq)
+		RLM3_MutexLock_Enter(&g_lock);
+
+	// Allocate buffer
+	size_t offset;
+	if (BeginOutputToBuffer(total_size, &offset))
+	{
+		// Write this log message into the buffer
+		if (is_interned)
+		{
+			// Another writer may define the same id at the same time.  A repeated definition is harmless.
+			if (is_level_defined)
+				SetInternWritten(level_id, offset);
+			if (is_zone_defined)
+				SetInternWritten(zone_id, offset + level_definition_size);
+			WriteToBuffer(&offset, header, header_size);
+		}
+		else
+			FormatToBuffer(&offset, header_size, "L %u %s %s ", (int)time, level, zone);
+		VFormatToBuffer(&offset, content_size, format, params);
+		FormatToBufferFn(&offset, '\n');
+		EndOutputToBuffer();
+	}
+
+	if (!is_irq)
+		RLM3_MutexLock_Leave(&g_lock);
+}
+
+static void FormatLogRecord(RLM3_Time time, const char* level, const char* zone, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	WriteLogRecord(time, level, zone, format, args);
+	va_end(args);
+}
+
+static bool BeginOutputToStaging(size_t size, size_t* offset_out)
+{
+	bool result = false;
+	uint32_t saved_level = EnterCritical(RLM3_LOGBUFFER_SITE_BEGIN_OUTPUT);
+	if (size <= STAGING_SIZE - g_staging_size)
+	{
+		*offset_out = g_staging_size;
+		g_staging_size += size;
+		result = true;
+	}
+	else
+		g_staging_dropped_size += size;
+	g_is_staging_channel_open = false;
 	ExitCritical(saved_level);
+	return result;
+}
+
+static void StageMessage(RLM3_Time time, const char* level, const char* zone, const char* format, va_list params)
+{
+	// Raw messages have no level or zone.  Staged records always use names, since ids are assigned after Init.
+	va_list args;
+	va_copy(args, params);
+	size_t header_size = (level != NULL) ? RLM3_FormatNoNul(NULL, 0, "L %u %s %s ", (int)time, level, zone) : 0;
+	size_t content_size = RLM3_VFormatNoNul(NULL, 0, format, args);
+	va_end(args);
+
+	size_t offset;
+	if (BeginOutputToStaging(header_size + content_size + 1, &offset))
+	{
+		if (level != NULL)
+			RLM3_FormatNoNul(g_staging + offset, header_size, "L %u %s %s ", (int)time, level, zone);
+		RLM3_VFormatNoNul(g_staging + offset + header_size, content_size, format, params);
+		g_staging[offset + header_size + content_size] = '\n';
+	}
+}
+
+static void StageDebugChar(const char* channel, char c)
+{
+	uint32_t saved_level = EnterCritical(RLM3_LOGBUFFER_SITE_DEBUG_CHAR);
+	size_t channel_size = strlen(channel);
+	if (c == '\n' || c == '\r')
+		g_is_staging_channel_open = false;
+	else if (g_is_staging_channel_open && channel_size == g_staging_channel_size && memcmp(g_staging + g_staging_channel_name, channel, channel_size) == 0)
+	{
+		// Replace the \n at the end of the line with the new character and add one more character.
+		if (g_staging_size < STAGING_SIZE)
+		{
+			g_staging[g_staging_size - 1] = (c < ' ' || c > '~') ? '?' : c;
+			g_staging[g_staging_size++] = '\n';
+		}
+		else
+			g_staging_dropped_size++;
+	}
+	else
+	{
+		// Output: "D CHANNEL C\n"
+		size_t header_size = channel_size + 5;
+		if (header_size <= STAGING_SIZE - g_staging_size)
+		{
+			char* header = g_staging + g_staging_size;
+			header[0] = 'D';
+			header[1] = ' ';
+			memcpy(header + 2, channel, channel_size);
+			header[channel_size + 2] = ' ';
+			header[channel_size + 3] = (c < ' ' || c > '~') ? '?' : c;
+			header[channel_size + 4] = '\n';
+			g_is_staging_channel_open = true;
+			g_staging_channel_name = g_staging_size + 2;
+			g_staging_channel_size = channel_size;
+			g_staging_size += header_size;
+		}
+		else
+			g_staging_dropped_size += header_size;
+	}
+	ExitCritical(saved_level);
+}
+
+static void CopyStagingToBuffer()
+{
+	// Interrupts may keep staging records while the copy runs, so copy until nothing new was staged and finish
+	// initializing in the same critical section that checks it.
+	size_t copied_size = 0;
+	while (true)
+	{
+		uint32_t saved_level = EnterCritical(RLM3_LOGBUFFER_SITE_COPY_STAGING);
+		size_t staged_size = g_staging_size;
+		g_is_staging_channel_open = false; // A debug line already copied must not be continued in place.
+		if (staged_size == copied_size)
+		{
+			g_stats.dropped_bytes += g_staging_dropped_size;
+			g_staging_size = 0;
+			g_staging_dropped_size = 0;
+			g_is_initialized = true;
+			ExitCritical(saved_level);
+			return;
+		}
+		ExitCritical(saved_level);
+
+		size_t offset;
+		if (BeginOutputToBuffer(staged_size - copied_size, &offset))
+		{
+			WriteToBuffer(&offset, g_staging + copied_size, staged_size - copied_size);
+			EndOutputToBuffer();
+		}
+		copied_size = staged_size;
+#ifdef TEST
+		SIM_LogBuffer_StagingCopied();
+#endif
+	}
 }
 
 extern void RLM3_LogBuffer_Init()
@@ -102,7 +580,7 @@ extern void RLM3_LogBuffer_Init()
 	RLM3_MutexLock_Init(&g_lock);
 
 	// If the current log information in the external memory is not valid, reset it.
-	ExternalMemoryLayout* external_memory = (ExternalMemoryLayout*)RLM3_EXTERNAL_MEMORY_ADDRESS;
+	ExternalMemoryLayout* external_memory = LOG_MEMORY;
 	if (external_memory->log_magic != LOG_MAGIC || external_memory->log_head - external_memory->log_tail > BUFFER_SIZE)
 	{
 		external_memory->log_head = 0;
@@ -110,18 +588,28 @@ extern void RLM3_LogBuffer_Init()
 	}
 	external_memory->log_magic = LOG_MAGIC;
 	g_log_allocation_head = external_memory->log_head;
-	g_debug_channel = NULL;
+	g_is_debug_channel_open = false;
 	g_is_overflow = false;
+	g_is_snapshot_active = false;
+	memset(g_retainers, 0, sizeof(g_retainers));
+	memset(&g_stats, 0, sizeof(g_stats));
+	memset(g_intern_slots, 0, sizeof(g_intern_slots));
+	g_intern_count = 0;
+	g_session_start = external_memory->log_head;
+#ifdef RLM3_LOG_BUFFER_PROFILE
+	RLM3_LogBuffer_ResetProfile();
+#endif
 
+	// The fault from the previous run goes first, followed by the records written before Init.
 	if (external_memory->fault_magic == FAULT_MAGIC)
 	{
 		external_memory->fault_magic = 0;
 		external_memory->fault_cause[sizeof(external_memory->fault_cause) - 1] = 0;
 		external_memory->fault_communication_thread_state[sizeof(external_memory->fault_communication_thread_state) - 1] = 0;
-		LOG_FATAL("Forced Restart: '%s' COMM: %s", external_memory->fault_cause, external_memory->fault_communication_thread_state);
+		RLM3_Time time = (RLM3_IsIRQ() ? RLM3_GetCurrentTimeFromISR() : RLM3_GetCurrentTime());
+		FormatLogRecord(time, "FATAL", "LOG_BUFFER", "Forced Restart: '%s' COMM: %s", external_memory->fault_cause, external_memory->fault_communication_thread_state);
 	}
-
-	g_is_initialized = true;
+	CopyStagingToBuffer();
 }
 
 extern void RLM3_LogBuffer_Deinit()
@@ -130,6 +618,11 @@ extern void RLM3_LogBuffer_Deinit()
 
 	RLM3_MutexLock_Deinit(&g_lock);
 
+	g_is_snapshot_active = false;
+	memset(g_retainers, 0, sizeof(g_retainers));
+	g_recorder_head = 0;
+	g_recorder_tail = 0;
+	g_is_recorder_flush_pending = false;
 	g_is_initialized = false;
 }
 
@@ -138,57 +631,70 @@ extern bool RLM3_LogBuffer_IsInit()
 	return g_is_initialized;
 }
 
-extern void RLM3_LogBuffer_WriteLogMessage(const char* level, const char* zone, const char* format, va_list params)
+static bool IsRecordableFormat(const char* format)
 {
-	if (!g_is_initialized)
+	// Recorded arguments are stored as plain words, so only integer and character conversions can be expanded, and only
+	// as many as there are recorded arguments.
+	size_t arg_count = 0;
+	for (const char* cursor = format; *cursor != 0; cursor++)
 	{
-		// Initialization is not complete, so messages cannot be stored.  Write them directly to the debug port.
-		RLM3_FnFormat(FormatToDebugOutput, NULL, "L 0 %s %s ", level, zone);
-		RLM3_FnVFormat(FormatToDebugOutput, NULL, format, params);
-		RLM3_DebugOutput('\n');
-		return;
+		if (*cursor != '%')
+			continue;
+		cursor++;
+		while (*cursor == '-' || *cursor == '0' || *cursor == ' ' || *cursor == '+' || (*cursor >= '1' && *cursor <= '9'))
+			cursor++;
+		if (*cursor == 0 || strchr("diuxXoc%", *cursor) == NULL)
+			return false;
+		if (*cursor != '%' && ++arg_count > RLM3_LOG_RECORDER_ARG_COUNT)
+			return false;
 	}
+	return true;
+}
 
-	bool is_irq = RLM3_IsIRQ();
-
-	// TODO: use a time offset to convert tick_count to a time with ms.
-	RLM3_Time tick_count = (is_irq ? RLM3_GetCurrentTimeFromISR() : RLM3_GetCurrentTime());
+static bool IsTriggerLevel(const char* level)
+{
+	return (strcmp(level, "ERROR") == 0 || strcmp(level, "FATAL") == 0);
+}
 
-	// Determine the size of this log message.
-	va_list args;
-	va_copy(args, params);
-	size_t header_size = RLM3_FormatNoNul(NULL, 0, "L %u %s %s ", (int)tick_count, level, zone);
-	size_t content_size = RLM3_VFormatNoNul(NULL, 0, format, args);
-	size_t total_size = header_size + content_size + 1;
-	va_end(args);
+static void FlushPendingRecorder()
+{
+	// Formatting the whole history takes too long for an ISR, so a trigger there is finished by the next task.
+	if (g_is_recorder_flush_pending && !RLM3_IsIRQ())
+		RLM3_LogBuffer_FlushRecorder();
+}
 
-	if (!is_irq)
-		RLM3_MutexLock_Enter(&g_lock);
+extern void RLM3_LogBuffer_WriteLogMessage(const char* level, const char* zone, const char* format, va_list params)
+{
+	// TODO: use a time offset to convert tick_count to a time with ms.
+	RLM3_Time tick_count = (RLM3_IsIRQ() ? RLM3_GetCurrentTimeFromISR() : RLM3_GetCurrentTime());
 
-	// Allocate buffer
-	size_t offset;
-	if (BeginOutputToBuffer(total_size, &offset))
+	if (!g_is_initialized)
 	{
-		// Write this log message into the buffer
-		RLM3_FnFormat(FormatToBufferFn, &offset, "L %u %s %s ", (int)tick_count, level, zone);
-		RLM3_FnVFormat(FormatToBufferFn, &offset, format, params);
-		FormatToBufferFn(&offset, '\n');
-		EndOutputToBuffer();
+		// Initialization is not complete, so the message is staged until Init.
+		StageMessage(tick_count, level, zone, format, params);
+		return;
 	}
 
-	if (!is_irq)
-		RLM3_MutexLock_Leave(&g_lock);
+	// Errors bring in the recorded history that led up to them.
+	if (IsTriggerLevel(level) && RLM3_IsIRQ())
+		g_is_recorder_flush_pending = true;
+	else if (IsTriggerLevel(level))
+		RLM3_LogBuffer_FlushRecorder();
+	else
+		FlushPendingRecorder();
+
+	WriteLogRecord(tick_count, level, zone, format, params);
 }
 
 extern void RLM3_LogBuffer_WriteRawMessage(const char* format, va_list params)
 {
 	if (!g_is_initialized)
 	{
-		// Initialization is not complete, so messages cannot be stored.  Write them directly to the debug port.
-		RLM3_FnVFormat(FormatToDebugOutput, NULL, format, params);
-		RLM3_DebugOutput('\n');
+		// Initialization is not complete, so the message is staged until Init.
+		StageMessage(0, NULL, NULL, format, params);
 		return;
 	}
+	FlushPendingRecorder();
 
 	bool is_irq = RLM3_IsIRQ();
 
@@ -207,7 +713,7 @@ extern void RLM3_LogBuffer_WriteRawMessage(const char* format, va_list params)
 	if (BeginOutputToBuffer(total_size, &offset))
 	{
 		// Write this log message into the buffer
-		RLM3_FnVFormat(FormatToBufferFn, &offset, format, params);
+		VFormatToBuffer(&offset, content_size, format, params);
 		FormatToBufferFn(&offset, '\n');
 		EndOutputToBuffer();
 	}
@@ -232,48 +738,304 @@ extern void RLM3_LogBuffer_FormatRawMessage(const char* format, ...)
 	va_end(args);
 }
 
-extern uint32_t RLM3_LogBuffer_FetchBlock(size_t max_size)
+extern void RLM3_LogBuffer_Record(const char* level, const char* zone, const char* format, uint32_t arg0, uint32_t arg1, uint32_t arg2, uint32_t arg3)
+{
+	RLM3_Time time = (RLM3_IsIRQ() ? RLM3_GetCurrentTimeFromISR() : RLM3_GetCurrentTime());
+
+	// The oldest entry is overwritten once the recorder is full.
+	uint32_t saved_level = EnterCritical(RLM3_LOGBUFFER_SITE_RECORD);
+	uint32_t head = g_recorder_head;
+	RecorderEntry* entry = &g_recorder[head % RECORDER_SIZE];
+	entry->time = time;
+	entry->level = level;
+	entry->zone = zone;
+	entry->format = format;
+	entry->args[0] = arg0;
+	entry->args[1] = arg1;
+	entry->args[2] = arg2;
+	entry->args[3] = arg3;
+	g_recorder_head = head + 1;
+	if (head + 1 - g_recorder_tail > RECORDER_SIZE)
+		g_recorder_tail = head + 1 - RECORDER_SIZE;
+	ExitCritical(saved_level);
+}
+
+extern void RLM3_LogBuffer_FlushRecorder()
+{
+	if (!g_is_initialized)
+		return;
+
+	g_is_recorder_flush_pending = false;
+	while (true)
+	{
+		// Take one entry at a time so recording is never blocked for long.
+		RecorderEntry entry;
+		uint32_t saved_level = EnterCritical(RLM3_LOGBUFFER_SITE_FLUSH_RECORDER);
+		bool is_empty = (g_recorder_tail == g_recorder_head);
+		if (!is_empty)
+			entry = g_recorder[g_recorder_tail++ % RECORDER_SIZE];
+		ExitCritical(saved_level);
+		if (is_empty)
+			break;
+
+		if (IsRecordableFormat(entry.format))
+			FormatLogRecord(entry.time, entry.level, entry.zone, entry.format, entry.args[0], entry.args[1], entry.args[2], entry.args[3]);
+		else
+			FormatLogRecord(entry.time, entry.level, entry.zone, "%s", entry.format);
+	}
+}
+
+extern size_t RLM3_LogBuffer_GetRecorderCount()
+{
+	return g_recorder_head - g_recorder_tail;
+}
+
+static void CheckOverflowRestart(uint32_t head, uint32_t tail)
 {
-	ASSERT(g_is_initialized);
-	uint32_t head = EXTERNAL_MEMORY->log_head;
-	uint32_t tail = EXTERNAL_MEMORY->log_tail;
 	// If the buffer gets full, we wait until it is half empty to add anything else in it.  This ensures we have reasonably coherent logs.
 	if (g_is_overflow && head - tail < FULL_BUFFER_RESTART_LIMIT)
 	{
 		g_is_overflow = false;
 		LOG_ALWAYS("Overflow");
 	}
+}
+
+extern uint32_t RLM3_LogBuffer_FetchBlock(size_t max_size)
+{
+	ASSERT(g_is_initialized);
+	FlushPendingRecorder();
+	uint32_t head = LOG_MEMORY->log_head;
+	uint32_t tail = LOG_MEMORY->log_tail;
+	CheckOverflowRestart(head, tail);
 	// Get the largest chunk of the buffer that is available.
 	uint32_t target = head;
 	if (target - tail > max_size)
 		target = tail + max_size;
 	// Try to reduce it so the block ends with a newline.
 	for (uint32_t i = 0; i < target - tail; i++)
-		if (EXTERNAL_MEMORY->log_buffer[(target - i - 1) % BUFFER_SIZE] == '\n')
+		if (LOG_MEMORY->log_buffer[(target - i - 1) & BUFFER_MASK] == '\n')
 			return target - i;
 	// The block does not have a newline to break on.
 	return target;
 }
 
+extern void RLM3_LogBuffer_AddRetainer(const volatile uint32_t* released_position)
+{
+	ASSERT(g_is_initialized);
+	ASSERT(released_position != NULL);
+	ASSERT(!RLM3_IsIRQ());
+
+	RLM3_MutexLock_Enter(&g_lock);
+	size_t index = 0;
+	while (index < RLM3_LOGBUFFER_MAX_RETAINERS && g_retainers[index] != NULL)
+		index++;
+	bool is_added = (index < RLM3_LOGBUFFER_MAX_RETAINERS);
+	if (is_added)
+		g_retainers[index] = released_position;
+	RLM3_MutexLock_Leave(&g_lock);
+	ASSERT(is_added);
+}
+
+extern void RLM3_LogBuffer_RemoveRetainer(const volatile uint32_t* released_position)
+{
+	ASSERT(!RLM3_IsIRQ());
+
+	// The retainer may already be gone if the log buffer was restarted.
+	if (!g_is_initialized)
+		return;
+	RLM3_MutexLock_Enter(&g_lock);
+	for (size_t i = 0; i < RLM3_LOGBUFFER_MAX_RETAINERS; i++)
+		if (g_retainers[i] == released_position)
+			g_retainers[i] = NULL;
+	RLM3_MutexLock_Leave(&g_lock);
+}
+
+extern void RLM3_LogBuffer_ReleaseData()
+{
+	ASSERT(g_is_initialized);
+	ASSERT(!RLM3_IsIRQ());
+	FlushPendingRecorder();
+
+	// Readers that have fallen behind log_tail have already lost their data and do not hold it back.
+	RLM3_MutexLock_Enter(&g_lock);
+	uint32_t head = LOG_MEMORY->log_head;
+	uint32_t tail = LOG_MEMORY->log_tail;
+	uint32_t released = head;
+	bool is_retained = false;
+	for (size_t i = 0; i < RLM3_LOGBUFFER_MAX_RETAINERS; i++)
+	{
+		if (g_retainers[i] == NULL)
+			continue;
+		uint32_t position = *g_retainers[i];
+		if (position - tail <= released - tail)
+			released = position;
+		is_retained = true;
+	}
+	if (is_retained)
+		LOG_MEMORY->log_tail = tail = released;
+	RLM3_MutexLock_Leave(&g_lock);
+
+	CheckOverflowRestart(head, tail);
+}
+
+extern void RLM3_LogBuffer_BeginSnapshot()
+{
+	ASSERT(g_is_initialized);
+	ASSERT(!g_is_snapshot_active);
+
+	ExternalMemoryLayout* external_memory = LOG_MEMORY;
+	SnapshotPrefix* prefix = &g_snapshot_prefix;
+	RLM3_LogSnapshotHeader* header = &prefix->header;
+
+	// Freeze the published part of the log.  Messages that are still being written are not part of the snapshot.
+	uint32_t saved_level = EnterCritical(RLM3_LOGBUFFER_SITE_BEGIN_SNAPSHOT);
+	header->log_magic = external_memory->log_magic;
+	header->log_head = external_memory->log_head;
+	header->log_tail = external_memory->log_tail;
+	header->fault_magic = external_memory->fault_magic;
+	memcpy(prefix->fault_cause, external_memory->fault_cause, sizeof(prefix->fault_cause));
+	memcpy(prefix->fault_communication_thread_state, external_memory->fault_communication_thread_state, sizeof(prefix->fault_communication_thread_state));
+	g_snapshot_cursor = header->log_tail;
+	g_snapshot_chunk_end = header->log_tail;
+	g_snapshot_end = header->log_head;
+	g_is_snapshot_prefix_sent = false;
+	g_snapshot_intern_count = g_intern_count;
+	g_snapshot_intern_index = 0;
+	g_is_snapshot_active = true;
+	ExitCritical(saved_level);
+
+	// Names never change once they are interned, so the table can be measured outside the critical section.
+	char record[INTERN_RECORD_SIZE];
+	uint32_t intern_size = 0;
+	for (size_t id = 0; id < g_snapshot_intern_count; id++)
+		intern_size += FormatInternRecord(record, (uint8_t)id);
+	uint32_t session_offset = g_session_start - header->log_tail;
+	if (session_offset > header->log_head - header->log_tail)
+		session_offset = 0;
+
+	header->magic = SNAPSHOT_MAGIC;
+	header->version = SNAPSHOT_VERSION;
+	header->header_size = sizeof(RLM3_LogSnapshotHeader);
+	header->buffer_size = BUFFER_SIZE;
+	header->fault_cause_offset = offsetof(SnapshotPrefix, fault_cause);
+	header->fault_cause_size = sizeof(prefix->fault_cause);
+	header->fault_thread_state_offset = offsetof(SnapshotPrefix, fault_communication_thread_state);
+	header->fault_thread_state_size = sizeof(prefix->fault_communication_thread_state);
+	header->intern_offset = sizeof(SnapshotPrefix);
+	header->intern_size = intern_size;
+	header->session_offset = session_offset;
+	header->data_offset = header->intern_offset + header->intern_size;
+	header->data_size = g_snapshot_end - g_snapshot_cursor;
+	header->total_size = header->data_offset + header->data_size;
+}
+
+extern size_t RLM3_LogBuffer_GetSnapshotChunk(const void** data_out)
+{
+	ASSERT(g_is_snapshot_active);
+
+	if (!g_is_snapshot_prefix_sent)
+	{
+		g_is_snapshot_prefix_sent = true;
+		*data_out = &g_snapshot_prefix;
+		return sizeof(g_snapshot_prefix);
+	}
+	if (g_snapshot_intern_index < g_snapshot_intern_count)
+	{
+		// One definition at a time, so the table does not need its own copy.
+		*data_out = g_snapshot_intern_record;
+		return FormatInternRecord(g_snapshot_intern_record, (uint8_t)g_snapshot_intern_index++);
+	}
+
+	// Asking for the next chunk releases the previous one, so live logging can reuse that space.  The chunk returned
+	// here stays protected until the next call or EndSnapshot.
+	uint32_t start = g_snapshot_chunk_end;
+	g_snapshot_cursor = start;
+	size_t offset = start & BUFFER_MASK;
+	size_t size = g_snapshot_end - start;
+	if (size > BUFFER_SIZE - offset)
+		size = BUFFER_SIZE - offset;
+	g_snapshot_chunk_end = start + size;
+	*data_out = LOG_MEMORY->log_buffer + offset;
+	return size;
+}
+
+extern void RLM3_LogBuffer_EndSnapshot()
+{
+	ASSERT(g_is_snapshot_active);
+
+	g_is_snapshot_active = false;
+}
+
+extern bool RLM3_LogBuffer_IsSnapshotActive()
+{
+	return g_is_snapshot_active;
+}
+
+extern void RLM3_LogBuffer_GetStats(RLM3_LogBufferStats* stats_out)
+{
+	ASSERT(stats_out != NULL);
+
+	uint32_t saved_level = EnterCritical(RLM3_LOGBUFFER_SITE_GET_STATS);
+	*stats_out = g_stats;
+	ExitCritical(saved_level);
+}
+
+extern const char* RLM3_LogBuffer_GetInternName(uint32_t id)
+{
+	return (id < g_intern_count) ? g_intern_names[id] : NULL;
+}
+
+extern bool RLM3_LogBuffer_IsCurrentSession(uint32_t position)
+{
+	if (!g_is_initialized)
+		return false;
+	// Once the start of this session has been released, everything left is from this session.
+	uint32_t tail = LOG_MEMORY->log_tail;
+	uint32_t head = LOG_MEMORY->log_head;
+	if (g_session_start - tail > head - tail)
+		return true;
+	return (position - tail >= g_session_start - tail);
+}
+
+extern void RLM3_LogBuffer_RepeatInternTable()
+{
+	for (size_t i = 0; i < INTERN_SIZE; i++)
+		g_is_intern_written[i] = false;
+}
+
+static bool IsDebugChannelOpen(const char* channel)
+{
+	// Must be called from inside a critical section.
+	if (!g_is_debug_channel_open)
+		return false;
+	if (g_debug_channel_id != INTERN_NONE)
+		return strcmp(channel, g_intern_names[g_debug_channel_id]) == 0;
+	for (size_t i = 0; i < g_debug_channel_size; i++)
+		if (channel[i] != LOG_MEMORY->log_buffer[(g_debug_channel_name + i) & BUFFER_MASK])
+			return false;
+	return channel[g_debug_channel_size] == 0;
+}
+
 extern void RLM3_LogBuffer_DebugChar(const char* channel, char c)
 {
 	ASSERT(channel != NULL);
 
 	if (!g_is_initialized)
 	{
-		RLM3_DebugOutput(c);
+		StageDebugChar(channel, c);
 		return;
 	}
 
-	ExternalMemoryLayout* external_memory = (ExternalMemoryLayout*)RLM3_EXTERNAL_MEMORY_ADDRESS;
+	ExternalMemoryLayout* external_memory = LOG_MEMORY;
 
-	uint32_t saved_level = EnterCritical();
+	uint32_t saved_level = EnterCritical(RLM3_LOGBUFFER_SITE_DEBUG_CHAR);
+	uint32_t original_head = external_memory->log_head;
 	if (c == '\n' || c == '\r')
 	{
 		// End any previous debug character message.
 		if (g_active_logger_count == 0)
 			external_memory->log_head = g_log_allocation_head;
-		g_debug_channel = NULL;
+		g_is_debug_channel_open = false;
 	}
 	else
 	{
@@ -281,42 +1043,70 @@ extern void RLM3_LogBuffer_DebugChar(const char* channel, char c)
 		if (c < ' ' || c > '~')
 			c = '?';
 
-		if (channel != g_debug_channel)
+		if (!IsDebugChannelOpen(channel))
 		{
-			// We are starting a new channel, so add a new header.
-			size_t available_size = BUFFER_SIZE - (g_log_allocation_head - external_memory->log_tail);
-			size_t header_size = strlen(channel) + 5; // Output: "D CHANNEL C\n"
-			if (header_size <= available_size && !g_is_overflow)
+			// We are starting a new channel, so add a new header.  Output: "d CHANNEL_ID C\n" or "D CHANNEL C\n"
+			char header[INTERN_RECORD_SIZE + 8];
+			size_t header_size = 0;
+			uint8_t channel_id = InternLocked(channel, HashInternName(channel));
+			bool is_channel_defined = (channel_id != INTERN_NONE && !IsInternWritten(channel_id));
+			if (is_channel_defined)
+				header_size += FormatInternRecord(header, channel_id);
+			if (channel_id != INTERN_NONE)
+			{
+				header[header_size++] = 'd';
+				header[header_size++] = ' ';
+				header_size += FormatNumber(header + header_size, channel_id);
+				header[header_size++] = ' ';
+				header[header_size++] = c;
+				header[header_size++] = '\n';
+			}
+			else
+				header_size = strlen(channel) + 5;
+
+			size_t available_size = GetAvailableSize(external_memory);
+			bool is_written = (header_size <= available_size && !g_is_overflow);
+			if (is_written)
 			{
 				// End the previous debug character message.
 				if (g_active_logger_count == 0)
 					external_memory->log_head = g_log_allocation_head;
 
 				// Allocate space for this header.
-				g_debug_channel = channel;
 				size_t head = g_log_allocation_head;
+				g_is_debug_channel_open = true;
+				g_debug_channel_id = channel_id;
+				g_debug_channel_name = head + 2;
+				g_debug_channel_size = header_size - 5;
 				g_log_allocation_head = head + header_size;
 
 				// Write this initial message into the buffer.
-				FormatToBufferFn(&head, 'D');
-				FormatToBufferFn(&head, ' ');
-				for (size_t i = 0; channel[i] != 0; i++)
-					FormatToBufferFn(&head, channel[i]);
-				FormatToBufferFn(&head, ' ');
-				FormatToBufferFn(&head, c);
-				FormatToBufferFn(&head, '\n');
+				if (channel_id != INTERN_NONE)
+				{
+					if (is_channel_defined)
+						SetInternWritten(channel_id, head);
+					WriteToBuffer(&head, header, header_size);
+				}
+				else
+				{
+					char tail[3] = { ' ', c, '\n' };
+					WriteToBuffer(&head, "D ", 2);
+					WriteToBuffer(&head, channel, header_size - 5);
+					WriteToBuffer(&head, tail, sizeof(tail));
+				}
 
 				ASSERT(head == g_log_allocation_head);
 			}
+			UpdateStats(external_memory, is_written, header_size);
 		}
 		else
 		{
 			// We are already writing to this channel, so just allocate one additional character.
-			size_t available_size = BUFFER_SIZE - (g_log_allocation_head - external_memory->log_tail);
-			if (1 <= available_size && !g_is_overflow)
+			size_t available_size = GetAvailableSize(external_memory);
+			bool is_written = (1 <= available_size && !g_is_overflow);
+			if (is_written)
 			{
 				// Replace the \n that is currently at the end of this log message with the new character and add one more character.
-				g_debug_channel = channel;
 				size_t head = g_log_allocation_head - 1;
 				g_log_allocation_head = head + 2;
 
@@ -326,7 +1116,67 @@ extern void RLM3_LogBuffer_DebugChar(const char* channel, char c)
 
 				ASSERT(head == g_log_allocation_head);
 			}
+			UpdateStats(external_memory, is_written, 1);
 		}
 	}
+	bool is_published = (external_memory->log_head != original_head);
 	ExitCritical(saved_level);
+
+	if (is_published)
+		RLM3_LogBuffer_DataAvailable_Callback();
+}
+
+#ifdef RLM3_LOG_BUFFER_PROFILE
+extern void RLM3_LogBuffer_GetProfile(RLM3_LogBuffer_Profile* profile_out)
+{
+	ASSERT(profile_out != NULL);
+
+	uint32_t saved_level = EnterCritical(RLM3_LOGBUFFER_SITE_GET_STATS);
+	*profile_out = g_profile;
+	ExitCritical(saved_level);
+}
+
+extern void RLM3_LogBuffer_ResetProfile()
+{
+#ifndef TEST
+	// Start the DWT cycle counter.
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+	memset(&g_profile, 0, sizeof(g_profile));
+}
+
+extern const char* RLM3_LogBuffer_GetProfileSiteName(RLM3_LogBuffer_ProfileSite site)
+{
+	ASSERT(site < RLM3_LOGBUFFER_SITE_COUNT);
+	return PROFILE_SITE_NAMES[site];
+}
+
+extern __attribute__((weak)) uint32_t RLM3_LogBuffer_GetCycleCount()
+{
+#ifdef TEST
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t)(now.tv_sec * 1000000000ull + now.tv_nsec);
+#else
+	return DWT->CYCCNT;
+#endif
+}
+#endif
+
+extern __attribute__((weak)) void RLM3_LogBuffer_DataAvailable_Callback()
+{
+	// Do nothing by default.
+}
+
+#ifdef TEST
+extern __attribute__((weak)) ExternalMemoryLayout* SIM_LogMemory()
+{
+	return EXTERNAL_MEMORY;
+}
+
+extern __attribute__((weak)) void SIM_LogBuffer_StagingCopied()
+{
+	// Do nothing by default.
 }
+#endif
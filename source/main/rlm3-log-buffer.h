@@ -1,6 +1,7 @@
 #pragma once
 
 #include "rlm3-base.h"
+#include "rlm3-settings.h"
 #include <stdarg.h>
 
 
@@ -9,10 +10,85 @@ extern "C" {
 #endif
 
 
+// Snapshot container: this header, the frozen fault fields, the intern table and then the log data from log_tail to
+// log_head.  All offsets are from the start of the container and all fields are little endian.  The intern table holds
+// an "I <id> <name>" record for every id of the session, so the data can be decoded even when log_tail has already
+// moved past the definitions in the log.
+typedef struct
+{
+	uint32_t magic; // 'LSNP'
+	uint16_t version;
+	uint16_t header_size;
+	uint32_t buffer_size;
+	uint32_t log_magic;
+	uint32_t log_head;
+	uint32_t log_tail;
+	uint32_t fault_magic;
+	uint32_t fault_cause_offset;
+	uint32_t fault_cause_size;
+	uint32_t fault_thread_state_offset;
+	uint32_t fault_thread_state_size;
+	uint32_t data_offset;
+	uint32_t data_size;
+	uint32_t total_size;
+	uint32_t intern_offset;
+	uint32_t intern_size;
+	uint32_t session_offset; // Data before this offset is from an earlier session and the intern table does not apply to it.
+} RLM3_LogSnapshotHeader;
+
+
+// Counters since Init.  Bytes are counted as they are stored, including record headers.
+typedef struct
+{
+	uint32_t written_bytes;
+	uint32_t dropped_bytes;
+	uint32_t overflow_count; // Number of times the buffer filled up and started dropping messages.
+	uint32_t peak_used_size;
+} RLM3_LogBufferStats;
+
+
+// Critical sections in the log buffer.  The profile is only kept when built with RLM3_LOG_BUFFER_PROFILE.  Sites are
+// the critical sections inside this module, not the log statements that lead to them.
+typedef enum
+{
+	RLM3_LOGBUFFER_SITE_BEGIN_OUTPUT,
+	RLM3_LOGBUFFER_SITE_END_OUTPUT,
+	RLM3_LOGBUFFER_SITE_DEBUG_CHAR,
+	RLM3_LOGBUFFER_SITE_RECORD,
+	RLM3_LOGBUFFER_SITE_FLUSH_RECORDER,
+	RLM3_LOGBUFFER_SITE_BEGIN_SNAPSHOT,
+	RLM3_LOGBUFFER_SITE_GET_STATS, // Also used when reading the profile.
+	RLM3_LOGBUFFER_SITE_INTERN,
+	RLM3_LOGBUFFER_SITE_COPY_STAGING,
+	RLM3_LOGBUFFER_SITE_COUNT
+} RLM3_LogBuffer_ProfileSite;
+
+#define RLM3_LOGBUFFER_PROFILE_BUCKET_COUNT (16)
+
+// Durations are in RLM3_LogBuffer_GetCycleCount units.  Histogram bucket i counts durations below 2^(i+1), and the
+// last bucket counts everything longer.
+typedef struct
+{
+	uint32_t count;
+	uint32_t max;
+	uint64_t total;
+	uint32_t histogram[RLM3_LOGBUFFER_PROFILE_BUCKET_COUNT];
+} RLM3_LogBuffer_ProfileSiteStats;
+
+typedef struct
+{
+	RLM3_LogBuffer_ProfileSiteStats sites[RLM3_LOGBUFFER_SITE_COUNT];
+	uint32_t worst;
+	RLM3_LogBuffer_ProfileSite worst_site;
+} RLM3_LogBuffer_Profile;
+
+
 extern void RLM3_LogBuffer_Init();
 extern void RLM3_LogBuffer_Deinit();
 extern bool RLM3_LogBuffer_IsInit();
 
+// Messages and debug characters written before Init are kept in a small staging buffer, and Init copies them into the
+// log after any fault record from the previous run.  Anything that does not fit is counted in dropped_bytes.
 extern void RLM3_LogBuffer_WriteLogMessage(const char* level, const char* zone, const char* format, va_list params) __attribute__ ((format (printf, 3, 0)));
 extern void RLM3_LogBuffer_WriteRawMessage(const char* format, va_list params) __attribute__ ((format (printf, 1, 0)));
 
@@ -21,8 +97,73 @@ extern void RLM3_LogBuffer_FormatRawMessage(const char* format, ...) __attribute
 
 extern void RLM3_LogBuffer_DebugChar(const char* channel, char c);
 
+// Levels, zones and debug channels are given small ids the first time they are used.  Records then carry the id ("l
+// <time> <level_id> <zone_id> <message>" and "d <channel_id> <chars>"), and each id is defined by an "I <id> <name>"
+// record written just ahead of its first use.  The definition is written again ahead of the next use once the log has
+// moved half the ring past it, so it stays in the ring, released or not, for a dump to find.  Names that are empty,
+// longer than 32 characters or contain spaces, and any names after the table is full, are written out in full ("L ..."
+// and "D ...").  Names are copied, so they do not need to outlive the call.  A consumer that missed the definitions can
+// call RepeatInternTable to have each id defined again before its next use.  Ids are only good for records from this
+// session: use IsCurrentSession to check a record's position before looking up its ids with GetInternName.
+extern const char* RLM3_LogBuffer_GetInternName(uint32_t id);
+extern bool RLM3_LogBuffer_IsCurrentSession(uint32_t position);
+extern void RLM3_LogBuffer_RepeatInternTable();
+
+extern void RLM3_LogBuffer_GetStats(RLM3_LogBufferStats* stats_out);
+
+// Flight recorder for verbose messages that are too expensive to log all the time.  Recording only stores the
+// arguments, so format, level and zone must be string literals and the format may only use up to ARG_COUNT integer and
+// character conversions.  The recorded history is formatted into the log ahead of the next ERROR or FATAL message, or
+// when FlushRecorder is called.  An ERROR from an ISR leaves the history to the next log write or fetch from a task.
+// Recording is allowed before Init and from an ISR.  The recorder is kept in RAM, so the fault handler must call
+// FlushRecorder to keep the history across the restart.
+#define RLM3_LOG_RECORDER_ARG_COUNT (4)
+extern void RLM3_LogBuffer_Record(const char* level, const char* zone, const char* format, uint32_t arg0, uint32_t arg1, uint32_t arg2, uint32_t arg3);
+extern void RLM3_LogBuffer_FlushRecorder();
+extern size_t RLM3_LogBuffer_GetRecorderCount();
+
 extern uint32_t RLM3_LogBuffer_FetchBlock(size_t max_size);
 
+// Readers that keep their data in the log until they release it, such as the uplink.  Each one publishes how far it is
+// done through the position it registers, and ReleaseData moves log_tail to the slowest of them, so nothing is
+// overwritten before every retaining reader has released it.  Init and Deinit forget all retaining readers.
+#define RLM3_LOGBUFFER_MAX_RETAINERS (4)
+extern void RLM3_LogBuffer_AddRetainer(const volatile uint32_t* released_position);
+extern void RLM3_LogBuffer_RemoveRetainer(const volatile uint32_t* released_position);
+extern void RLM3_LogBuffer_ReleaseData();
+
+extern void RLM3_LogBuffer_BeginSnapshot();
+extern size_t RLM3_LogBuffer_GetSnapshotChunk(const void** data_out);
+extern void RLM3_LogBuffer_EndSnapshot();
+extern bool RLM3_LogBuffer_IsSnapshotActive();
+
+#ifdef RLM3_LOG_BUFFER_PROFILE
+extern void RLM3_LogBuffer_GetProfile(RLM3_LogBuffer_Profile* profile_out);
+extern void RLM3_LogBuffer_ResetProfile();
+extern const char* RLM3_LogBuffer_GetProfileSiteName(RLM3_LogBuffer_ProfileSite site);
+// Free running counter used to time critical sections.  The default is the DWT cycle counter on the target and
+// nanoseconds in TEST builds.
+extern uint32_t RLM3_LogBuffer_GetCycleCount();
+#endif
+
+// Called whenever new data becomes visible at log_head.  May be called from an ISR.
+extern void RLM3_LogBuffer_DataAvailable_Callback();
+
+// The log lives in EXTERNAL_MEMORY.  TEST builds reach it through SIM_LogMemory, which simulation support may replace to
+// move the log somewhere else.
+#ifdef TEST
+extern ExternalMemoryLayout* SIM_LogMemory();
+#define LOG_MEMORY (SIM_LogMemory())
+#else
+#define LOG_MEMORY EXTERNAL_MEMORY
+#endif
+
+// Called in TEST builds after each pass of Init's copy out of the staging buffer, so tests can stage records while the
+// copy is still running.
+#ifdef TEST
+extern void SIM_LogBuffer_StagingCopied();
+#endif
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,346 @@
+#include "rlm3-log-sink.h"
+#include "rlm3-log-buffer.h"
+#include "Assert.h"
+#include "rlm3-base.h"
+#include "rlm3-settings.h"
+#include "rlm3-task.h"
+#include <string.h>
+
+
+static const size_t BUFFER_SIZE = sizeof(ExternalMemoryLayout::log_buffer);
+static const size_t BUFFER_MASK = BUFFER_SIZE - 1;
+static const size_t MAX_SCAN_SIZE = 512; // Limits the work done by one peek so it is safe to call from an ISR.
+
+static const char* const LEVEL_NAMES[] = { "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL", "ALWAYS" };
+
+
+static char GetChar(uint32_t position)
+{
+	return LOG_MEMORY->log_buffer[position & BUFFER_MASK];
+}
+
+static RLM3_Time GetTime()
+{
+	return RLM3_IsIRQ() ? RLM3_GetCurrentTimeFromISR() : RLM3_GetCurrentTime();
+}
+
+static bool MatchWord(uint32_t position, uint32_t end, const char* word)
+{
+	// Matches a word that is followed by a space.
+	for (; *word != 0; word++, position++)
+		if (position == end || GetChar(position) != *word)
+			return false;
+	return (position != end && GetChar(position) == ' ');
+}
+
+static uint32_t SkipWord(uint32_t position, uint32_t end)
+{
+	while (position != end && GetChar(position) != ' ')
+		position++;
+	return (position != end) ? position + 1 : end;
+}
+
+static const char* GetInternName(uint32_t position, uint32_t end)
+{
+	uint32_t id = 0;
+	uint32_t start = position;
+	while (position != end && GetChar(position) >= '0' && GetChar(position) <= '9')
+		id = 10 * id + (GetChar(position++) - '0');
+	return (position != start) ? RLM3_LogBuffer_GetInternName(id) : NULL;
+}
+
+static bool IsAccepted(const RLM3_LogSink* sink, uint32_t start, uint32_t end)
+{
+	// Log records look like "L <time> <level> <zone> <message>" or "l <time> <level_id> <zone_id> <message>".  Intern
+	// definitions are sent so the reader can decode the records that follow, unless the sink expands the ids itself.
+	// Anything else is debug output, a response or raw text.
+	const RLM3_LogSink_Filter* filter = &sink->filter;
+	if (end - start >= 2 && GetChar(start) == 'I' && GetChar(start + 1) == ' ')
+		return !sink->is_expanded;
+	if (end - start < 2 || (GetChar(start) != 'L' && GetChar(start) != 'l') || GetChar(start + 1) != ' ')
+		return !filter->is_other_skipped;
+	bool is_interned = (GetChar(start) == 'l');
+	bool is_known = is_interned && RLM3_LogBuffer_IsCurrentSession(start); // Ids from an earlier session are unknown.
+
+	uint32_t level_position = SkipWord(start + 2, end);
+	uint32_t zone_position = SkipWord(level_position, end);
+	const char* level_name = is_known ? GetInternName(level_position, end) : NULL;
+	const char* zone_name = is_known ? GetInternName(zone_position, end) : NULL;
+
+	RLM3_LogSink_Level level = RLM3_LOGSINK_LEVEL_ALWAYS;
+	for (size_t i = 0; i < sizeof(LEVEL_NAMES) / sizeof(LEVEL_NAMES[0]); i++)
+		if (is_interned ? (level_name != NULL && strcmp(level_name, LEVEL_NAMES[i]) == 0) : MatchWord(level_position, end, LEVEL_NAMES[i]))
+			level = (RLM3_LogSink_Level)i;
+	if (level < filter->level)
+		return false;
+
+	if (filter->zone_count == 0)
+		return true;
+	for (size_t i = 0; i < filter->zone_count; i++)
+		if (is_interned ? (zone_name != NULL && strcmp(zone_name, filter->zones[i]) == 0) : MatchWord(zone_position, end, filter->zones[i]))
+			return true;
+	return false;
+}
+
+static bool IsPassThrough(const RLM3_LogSink* sink)
+{
+	const RLM3_LogSink_Filter* filter = &sink->filter;
+	return (filter->level == RLM3_LOGSINK_LEVEL_TRACE && filter->zone_count == 0 && !filter->is_other_skipped && filter->rate == 0 && !sink->is_expanded);
+}
+
+static void AppendHeader(RLM3_LogSink* sink, size_t* size, const char* text)
+{
+	while (*text != 0)
+		sink->header[(*size)++] = *text++;
+	sink->header[(*size)++] = ' ';
+}
+
+static uint32_t ExpandHeader(RLM3_LogSink* sink, uint32_t start, uint32_t end)
+{
+	// "l <time> <level_id> <zone_id> " becomes "L <time> <level> <zone> " and "d <channel_id> " becomes "D <channel> ".
+	// Returns where the rest of the record starts, or start when the record is sent as it is.
+	char type = GetChar(start);
+	if (end - start < 2 || (type != 'l' && type != 'd') || GetChar(start + 1) != ' ' || !RLM3_LogBuffer_IsCurrentSession(start))
+		return start;
+
+	size_t size = 0;
+	sink->header[size++] = (type == 'l') ? 'L' : 'D';
+	sink->header[size++] = ' ';
+	uint32_t position = start + 2;
+	if (type == 'l')
+	{
+		for (; position != end && GetChar(position) >= '0' && GetChar(position) <= '9' && size < 12; position++)
+			sink->header[size++] = GetChar(position);
+		if (position == end || GetChar(position) != ' ')
+			return start;
+		sink->header[size++] = ' ';
+		position++;
+	}
+	for (size_t i = (type == 'l') ? 2 : 1; i > 0; i--)
+	{
+		const char* name = GetInternName(position, end);
+		if (name == NULL)
+			return start;
+		AppendHeader(sink, &size, name);
+		position = SkipWord(position, end);
+	}
+	sink->header_size = (uint8_t)size;
+	sink->header_offset = 0;
+	return position;
+}
+
+static bool TakeTokens(RLM3_LogSink* sink, size_t size)
+{
+	if (sink->filter.rate == 0)
+		return true;
+
+	uint64_t capacity = 1000 * (uint64_t)sink->filter.burst;
+	RLM3_Time now = GetTime();
+	sink->tokens += (uint64_t)(now - sink->refill_time) * sink->filter.rate;
+	if (sink->tokens > capacity)
+		sink->tokens = capacity;
+	sink->refill_time = now;
+
+	// A record bigger than the burst size can still go out once the bucket is full.
+	uint64_t cost = 1000 * (uint64_t)size;
+	uint64_t needed = (cost < capacity) ? cost : capacity;
+	sink->is_rate_limited = (sink->tokens < needed);
+	if (sink->is_rate_limited)
+	{
+		// Tokens come in at rate thousandths of a byte per ms.
+		sink->ready_time = now + (RLM3_Time)((needed - sink->tokens + sink->filter.rate - 1) / sink->filter.rate);
+		return false;
+	}
+	sink->tokens = (sink->tokens > cost) ? sink->tokens - cost : 0;
+	return true;
+}
+
+static void CheckCursor(RLM3_LogSink* sink, uint32_t head)
+{
+	// Data behind log_tail may already be overwritten.
+	uint32_t tail = LOG_MEMORY->log_tail;
+	if (sink->cursor - tail > head - tail)
+	{
+		sink->lost_bytes += tail - sink->cursor;
+		sink->cursor = tail;
+		sink->record_end = tail;
+		sink->scan_position = tail;
+		sink->header_size = 0;
+		sink->header_offset = 0;
+	}
+}
+
+extern void RLM3_LogSink_Init(RLM3_LogSink* sink, const RLM3_LogSink_Filter* filter)
+{
+	ASSERT(sink != NULL && filter != NULL);
+	ASSERT(RLM3_LogBuffer_IsInit());
+
+	memset(sink, 0, sizeof(*sink));
+	sink->filter = *filter;
+	sink->cursor = LOG_MEMORY->log_tail;
+	sink->record_end = sink->cursor;
+	sink->scan_position = sink->cursor;
+	sink->released = sink->cursor;
+	sink->tokens = 1000 * (uint64_t)filter->burst;
+	sink->refill_time = GetTime();
+}
+
+extern void RLM3_LogSink_SetFilter(RLM3_LogSink* sink, const RLM3_LogSink_Filter* filter)
+{
+	ASSERT(sink != NULL && filter != NULL);
+
+	// The record being sent is finished with the old filter.
+	sink->filter = *filter;
+	sink->is_rate_limited = false;
+	if (sink->tokens > 1000 * (uint64_t)filter->burst)
+		sink->tokens = 1000 * (uint64_t)filter->burst;
+}
+
+extern void RLM3_LogSink_SetExpanded(RLM3_LogSink* sink, bool is_expanded)
+{
+	ASSERT(sink != NULL);
+
+	// The record being sent is finished as it was started.
+	sink->is_expanded = is_expanded;
+}
+
+extern size_t RLM3_LogSink_Peek(RLM3_LogSink* sink, const char** data_out)
+{
+	ASSERT(sink != NULL && data_out != NULL);
+
+	uint32_t head = LOG_MEMORY->log_head;
+	CheckCursor(sink, head);
+
+	// The expanded header goes out ahead of the rest of its record.
+	if (sink->header_offset != sink->header_size)
+	{
+		*data_out = sink->header + sink->header_offset;
+		return sink->header_size - sink->header_offset;
+	}
+
+	// Without a filter there is no need to look for record boundaries.
+	if (IsPassThrough(sink) && sink->cursor == sink->record_end)
+	{
+		sink->record_end = head;
+		sink->scan_position = head;
+	}
+
+	// Between records, find the next one this sink wants.
+	size_t scan_size = 0;
+	while (sink->cursor == sink->record_end)
+	{
+		// Long records may take more than one call to scan.
+		uint32_t start = sink->cursor;
+		uint32_t end = (sink->scan_position - start <= head - start) ? sink->scan_position : start;
+		while (end != head && GetChar(end) != '\n' && scan_size < MAX_SCAN_SIZE)
+		{
+			end++;
+			scan_size++;
+		}
+		sink->scan_position = end;
+		if (end == head || GetChar(end) != '\n')
+			return 0;
+		end++;
+
+		if (!IsAccepted(sink, start, end))
+		{
+			sink->cursor = end;
+			sink->record_end = end;
+			sink->scan_position = end;
+			sink->skipped_records++;
+			continue;
+		}
+		uint32_t body = sink->is_expanded ? ExpandHeader(sink, start, end) : start;
+		if (!TakeTokens(sink, sink->header_size + (end - body)))
+		{
+			sink->header_size = 0;
+			return 0;
+		}
+		sink->cursor = body;
+		sink->record_end = end;
+		sink->scan_position = end;
+		if (sink->header_size != 0)
+		{
+			*data_out = sink->header;
+			return sink->header_size;
+		}
+	}
+
+	size_t offset = sink->cursor & BUFFER_MASK;
+	size_t size = sink->record_end - sink->cursor;
+	if (size > BUFFER_SIZE - offset)
+		size = BUFFER_SIZE - offset;
+	*data_out = LOG_MEMORY->log_buffer + offset;
+	return size;
+}
+
+extern void RLM3_LogSink_Consume(RLM3_LogSink* sink, size_t size)
+{
+	ASSERT(sink != NULL);
+
+	if (sink->header_offset != sink->header_size)
+	{
+		ASSERT(size <= (size_t)(sink->header_size - sink->header_offset));
+		sink->header_offset += size;
+		if (sink->header_offset == sink->header_size)
+			sink->header_size = sink->header_offset = 0;
+		return;
+	}
+	ASSERT(size <= sink->record_end - sink->cursor);
+	sink->cursor += size;
+}
+
+extern bool RLM3_LogSink_IsCaughtUp(RLM3_LogSink* sink)
+{
+	ASSERT(sink != NULL);
+
+	uint32_t head = LOG_MEMORY->log_head;
+	CheckCursor(sink, head);
+	return sink->cursor == head;
+}
+
+extern uint32_t RLM3_LogSink_GetBacklog(RLM3_LogSink* sink)
+{
+	ASSERT(sink != NULL);
+
+	uint32_t head = LOG_MEMORY->log_head;
+	CheckCursor(sink, head);
+	return head - sink->cursor;
+}
+
+extern RLM3_Time RLM3_LogSink_GetRateLimitWait(const RLM3_LogSink* sink)
+{
+	ASSERT(sink != NULL);
+
+	if (!sink->is_rate_limited)
+		return 0;
+	RLM3_Time now = GetTime();
+	return ((int32_t)(sink->ready_time - now) > 0) ? sink->ready_time - now : 0;
+}
+
+extern void RLM3_LogSink_SetRetaining(RLM3_LogSink* sink, bool is_retaining)
+{
+	ASSERT(sink != NULL);
+
+	if (is_retaining == sink->is_retaining)
+		return;
+	sink->is_retaining = is_retaining;
+	if (is_retaining)
+	{
+		// Only what has not been read yet is held back.
+		sink->released = sink->cursor;
+		RLM3_LogBuffer_AddRetainer(&sink->released);
+	}
+	else
+		RLM3_LogBuffer_RemoveRetainer(&sink->released);
+}
+
+extern void RLM3_LogSink_Release(RLM3_LogSink* sink, uint32_t position)
+{
+	ASSERT(sink != NULL);
+	ASSERT(sink->is_retaining);
+	ASSERT(position - sink->released <= sink->cursor - sink->released);
+
+	sink->released = position;
+	RLM3_LogBuffer_ReleaseData();
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "rlm3-base.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef enum
+{
+	RLM3_LOGSINK_LEVEL_TRACE,
+	RLM3_LOGSINK_LEVEL_DEBUG,
+	RLM3_LOGSINK_LEVEL_INFO,
+	RLM3_LOGSINK_LEVEL_WARN,
+	RLM3_LOGSINK_LEVEL_ERROR,
+	RLM3_LOGSINK_LEVEL_FATAL,
+	RLM3_LOGSINK_LEVEL_ALWAYS, // Also used for levels that are not recognized.
+} RLM3_LogSink_Level;
+
+typedef struct
+{
+	RLM3_LogSink_Level level; // Log records below this level are skipped.
+	const char* const* zones; // When zone_count is not 0, only log records from these zones are sent.
+	size_t zone_count;
+	bool is_other_skipped; // Skip debug channel output, command responses and raw messages.
+	uint32_t rate; // Bytes per second, or 0 for no limit.
+	uint32_t burst; // Bytes that can be sent at once after the sink has been idle.
+} RLM3_LogSink_Filter;
+
+#define RLM3_LOGSINK_EXPANDED_HEADER_SIZE (80) // "L <time> <level> <zone> " with the longest interned names.
+
+// An independent reader of the log buffer.  Each sink has its own cursor and filter, and filtering is done on the
+// record headers as the sink reads, so no records are copied.  A retaining sink holds its data in the log until it
+// releases it, and log_tail follows the slowest retaining sink.  Other sinks never hold log_tail back; one that falls
+// behind log_tail skips ahead and counts the lost bytes.  The debug console is a plain sink and the uplink batcher reads
+// through a retaining one.
+typedef struct
+{
+	RLM3_LogSink_Filter filter;
+
+	uint32_t cursor;
+	uint32_t record_end; // The end of the accepted record being sent, or the cursor between records.
+	uint32_t scan_position; // How far the search for the end of the next record has come.
+
+	bool is_expanded;
+	char header[RLM3_LOGSINK_EXPANDED_HEADER_SIZE]; // The expanded header of the record being sent.
+	uint8_t header_size;
+	uint8_t header_offset;
+
+	uint64_t tokens; // In thousandths of a byte.
+	RLM3_Time refill_time;
+	bool is_rate_limited; // The next record is waiting for tokens.
+	RLM3_Time ready_time; // When there will be enough tokens for it.
+
+	uint32_t skipped_records;
+	uint32_t lost_bytes;
+
+	bool is_retaining;
+	volatile uint32_t released; // Everything before this position may be overwritten.
+} RLM3_LogSink;
+
+
+extern void RLM3_LogSink_Init(RLM3_LogSink* sink, const RLM3_LogSink_Filter* filter);
+extern void RLM3_LogSink_SetFilter(RLM3_LogSink* sink, const RLM3_LogSink_Filter* filter);
+// For readers that cannot decode interned records: ids are replaced with their names ("L <time> <level> <zone> ..."
+// and "D <channel> ...") and the "I" definitions are left out.  Records from an earlier session are sent as they are.
+extern void RLM3_LogSink_SetExpanded(RLM3_LogSink* sink, bool is_expanded);
+
+extern size_t RLM3_LogSink_Peek(RLM3_LogSink* sink, const char** data_out);
+extern void RLM3_LogSink_Consume(RLM3_LogSink* sink, size_t size);
+extern bool RLM3_LogSink_IsCaughtUp(RLM3_LogSink* sink);
+extern uint32_t RLM3_LogSink_GetBacklog(RLM3_LogSink* sink);
+extern RLM3_Time RLM3_LogSink_GetRateLimitWait(const RLM3_LogSink* sink); // 0 unless the next record is waiting for tokens.
+
+// A retaining sink is registered with the log buffer by its address, so it must not be moved or copied over while it is
+// retaining.  Release gives back everything before position, which must be at a record boundary the sink has reached.
+extern void RLM3_LogSink_SetRetaining(RLM3_LogSink* sink, bool is_retaining);
+extern void RLM3_LogSink_Release(RLM3_LogSink* sink, uint32_t position);
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,58 @@
+#include "rlm3-timer-ext.h"
+#include "rlm3-timer.h"
+#include "Assert.h"
+#ifndef TEST
+#include "stm32f4xx.h"
+#endif
+
+
+#ifndef TEST
+
+extern __attribute__((weak)) void RLM3_Timer2_EnableInterrupt()
+{
+	ASSERT(RLM3_Timer2_IsInit());
+	TIM2->DIER |= TIM_DIER_UIE;
+}
+
+extern __attribute__((weak)) void RLM3_Timer2_DisableInterrupt()
+{
+	ASSERT(RLM3_Timer2_IsInit());
+	TIM2->DIER &= ~TIM_DIER_UIE;
+}
+
+extern __attribute__((weak)) void RLM3_Timer2_SetPeriod(uint32_t period_us)
+{
+	ASSERT(RLM3_Timer2_IsInit());
+	ASSERT(period_us != 0);
+
+	// TIM2 runs from the APB1 timer clock, which is twice PCLK1 whenever APB1 is divided.  The prescaler is left as
+	// RLM3_Timer2_Init set it.
+	uint32_t apb1_shift = APBPrescTable[(RCC->CFGR & RCC_CFGR_PPRE1) >> RCC_CFGR_PPRE1_Pos];
+	uint32_t timer_clock = (SystemCoreClock >> apb1_shift) * ((apb1_shift != 0) ? 2 : 1);
+	uint64_t counter_clock = timer_clock / (TIM2->PSC + 1);
+	uint64_t reload = counter_clock * period_us / 1000000;
+	TIM2->ARR = (uint32_t)((reload > 1) ? reload - 1 : 1);
+	if (TIM2->CNT > TIM2->ARR)
+		TIM2->CNT = 0;
+}
+
+#else
+
+// The simulated timer never interrupts on its own.  Tests replace these to follow the calls.
+extern __attribute__((weak)) void RLM3_Timer2_EnableInterrupt()
+{
+	ASSERT(RLM3_Timer2_IsInit());
+}
+
+extern __attribute__((weak)) void RLM3_Timer2_DisableInterrupt()
+{
+	ASSERT(RLM3_Timer2_IsInit());
+}
+
+extern __attribute__((weak)) void RLM3_Timer2_SetPeriod(uint32_t period_us)
+{
+	ASSERT(RLM3_Timer2_IsInit());
+	ASSERT(period_us != 0);
+}
+
+#endif
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "rlm3-base.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Timer2 calls the rlm3-base driver does not provide yet.  They are weak, so a driver that provides them takes over.
+// Timer2 must be initialized.  The update interrupt calls RLM3_Timer2_Event_Callback while it is enabled.
+extern void RLM3_Timer2_EnableInterrupt();
+extern void RLM3_Timer2_DisableInterrupt();
+// Changes the time between update events.  Takes effect from the next update event.
+extern void RLM3_Timer2_SetPeriod(uint32_t period_us);
+
+
+#ifdef __cplusplus
+}
+#endif
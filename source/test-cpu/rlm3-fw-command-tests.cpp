@@ -0,0 +1,293 @@
+#include "Test.hpp"
+#include "rlm3-fw-command.h"
+#include "rlm3-log-buffer.h"
+#include "rlm3-memory.h"
+#include "rlm3-settings.h"
+#include "rlm3-task.h"
+#include "rlm3-sim.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+
+static constexpr size_t LOG_BUFFER_SIZE = sizeof(ExternalMemoryLayout::log_buffer);
+
+
+static std::string g_last_args;
+static size_t g_continue_count;
+
+
+static std::string GetLog()
+{
+	std::string result;
+	for (uint32_t i = EXTERNAL_MEMORY->log_tail; i != EXTERNAL_MEMORY->log_head; i++)
+		result += EXTERNAL_MEMORY->log_buffer[i % LOG_BUFFER_SIZE];
+	return result;
+}
+
+static void SendFromISR(const char* text)
+{
+	SIM_DoInterrupt([=] {
+		for (size_t i = 0; text[i] != 0; i++)
+			RLM3_FwCommand_PutCharFromISR(text[i]);
+	});
+}
+
+static RLM3_FwCommand_Result EchoCommand(size_t argc, char** argv)
+{
+	g_last_args.clear();
+	for (size_t i = 0; i < argc; i++)
+		g_last_args += std::string(argv[i]) + "|";
+	RLM3_FwCommand_Respond("%u", (unsigned)argc);
+	return RLM3_FWCOMMAND_DONE;
+}
+
+static RLM3_FwCommand_Result SlowCommand(size_t argc, char** argv)
+{
+	// Do work in 1 ms slices until the budget runs out, then ask to be resumed.
+	while (!RLM3_FwCommand_IsOverBudget())
+		RLM3_Delay(1);
+	if (++g_continue_count < 3)
+		return RLM3_FWCOMMAND_CONTINUE;
+	RLM3_FwCommand_Respond("%s", argv[1]);
+	return RLM3_FWCOMMAND_DONE;
+}
+
+static void InitCommands()
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_FwCommand_Init();
+	g_last_args.clear();
+	g_continue_count = 0;
+}
+
+
+TEST_CASE(RLM3_FwCommand_Lifecycle)
+{
+	ASSERT(!RLM3_FwCommand_IsInit());
+	RLM3_FwCommand_Init();
+	ASSERT(RLM3_FwCommand_IsInit());
+	RLM3_FwCommand_Deinit();
+	ASSERT(!RLM3_FwCommand_IsInit());
+}
+
+TEST_CASE(RLM3_FwCommand_Init_AlreadyInitialized)
+{
+	RLM3_FwCommand_Init();
+	ASSERT_ASSERTS(RLM3_FwCommand_Init());
+}
+
+TEST_CASE(RLM3_FwCommand_Deinit_NeverInitialized)
+{
+	ASSERT_ASSERTS(RLM3_FwCommand_Deinit());
+}
+
+TEST_CASE(RLM3_FwCommand_Put_NotInitialized)
+{
+	ASSERT(!RLM3_FwCommand_PutCharFromISR('a'));
+}
+
+TEST_CASE(RLM3_FwCommand_Dispatch_Ping)
+{
+	InitCommands();
+
+	SendFromISR("C 7 ping\n");
+	size_t count = RLM3_FwCommand_Dispatch();
+
+	ASSERT(count == 1);
+	ASSERT(GetLog() == "R 7 pong\n");
+}
+
+TEST_CASE(RLM3_FwCommand_Dispatch_Empty)
+{
+	InitCommands();
+
+	ASSERT(RLM3_FwCommand_Dispatch() == 0);
+	ASSERT(GetLog() == "");
+}
+
+TEST_CASE(RLM3_FwCommand_Dispatch_PartialFrame)
+{
+	InitCommands();
+
+	SendFromISR("C 7 pi");
+	ASSERT(RLM3_FwCommand_Dispatch() == 0);
+	SendFromISR("ng\r");
+	ASSERT(RLM3_FwCommand_Dispatch() == 1);
+
+	ASSERT(GetLog() == "R 7 pong\n");
+}
+
+TEST_CASE(RLM3_FwCommand_Dispatch_Arguments)
+{
+	InitCommands();
+	ASSERT(RLM3_FwCommand_Register("echo", EchoCommand));
+
+	SendFromISR("C 1 echo  abc d\n");
+	RLM3_FwCommand_Dispatch();
+
+	ASSERT(g_last_args == "echo|abc|d|");
+	ASSERT(GetLog() == "R 1 3\n");
+}
+
+TEST_CASE(RLM3_FwCommand_Dispatch_Unknown)
+{
+	InitCommands();
+
+	SendFromISR("C 2 bogus\n");
+	RLM3_FwCommand_Dispatch();
+
+	ASSERT(GetLog() == "R 2 ERROR unknown 'bogus'\n");
+}
+
+TEST_CASE(RLM3_FwCommand_Dispatch_Malformed)
+{
+	InitCommands();
+
+	SendFromISR("X 2 ping\n\nC 3\n");
+	RLM3_FwCommand_Dispatch();
+
+	ASSERT(GetLog() == "R - ERROR malformed\nR - ERROR malformed\n");
+}
+
+TEST_CASE(RLM3_FwCommand_Dispatch_Block)
+{
+	InitCommands();
+
+	SIM_DoInterrupt([] { ASSERT(RLM3_FwCommand_PutFromISR("C 1 ping\nC 2 ping\n", 18)); });
+	RLM3_FwCommand_Dispatch();
+
+	ASSERT(GetLog() == "R 1 pong\nR 2 pong\n");
+}
+
+TEST_CASE(RLM3_FwCommand_Dispatch_Wrapped)
+{
+	InitCommands();
+	ASSERT(RLM3_FwCommand_Register("echo", EchoCommand));
+
+	// Move the buffer position so the next frame wraps the end of the buffer.
+	std::string filler(500, 'x');
+	filler[499] = '\n';
+	SendFromISR(filler.c_str());
+	RLM3_FwCommand_Dispatch();
+	EXTERNAL_MEMORY->log_tail = EXTERNAL_MEMORY->log_head;
+
+	SendFromISR("C 4 echo wrapped-argument\n");
+	RLM3_FwCommand_Dispatch();
+
+	ASSERT(g_last_args == "echo|wrapped-argument|");
+	ASSERT(GetLog() == "R 4 2\n");
+}
+
+TEST_CASE(RLM3_FwCommand_Dispatch_Overflow)
+{
+	InitCommands();
+
+	// A frame larger than the buffer is dropped, but the following frame is still handled.
+	std::string big = "C 1 ping " + std::string(600, 'a') + "\n";
+	SendFromISR(big.c_str());
+	RLM3_FwCommand_Dispatch();
+	SendFromISR("C 2 ping\n");
+	RLM3_FwCommand_Dispatch();
+
+	ASSERT(GetLog() == "R - ERROR overflow\nR 2 pong\n");
+}
+
+TEST_CASE(RLM3_FwCommand_Dispatch_OverflowAtTerminator)
+{
+	InitCommands();
+
+	// The first frame fills the buffer exactly, so its terminator takes the reserved slot.  The second frame is lost
+	// while the buffer is full, but the third one starts clean.
+	std::string full = "C 1 ping " + std::string(511 - 9, 'a') + "\n";
+	SendFromISR(full.c_str());
+	SendFromISR("C 2 ping\n");
+	RLM3_FwCommand_Dispatch();
+	SendFromISR("C 3 ping\n");
+	RLM3_FwCommand_Dispatch();
+
+	ASSERT(GetLog() == "R 1 pong\nR - ERROR overflow\nR 3 pong\n");
+}
+
+TEST_CASE(RLM3_FwCommand_Dispatch_Budget)
+{
+	InitCommands();
+	ASSERT(RLM3_FwCommand_Register("slow", SlowCommand));
+
+	SendFromISR("C 5 slow done\nC 6 ping\n");
+
+	// The slow command yields twice and keeps its arguments in place between calls.
+	ASSERT(RLM3_FwCommand_Dispatch() == 0);
+	ASSERT(RLM3_FwCommand_Dispatch() == 0);
+	ASSERT(GetLog() == "");
+	ASSERT(RLM3_FwCommand_Dispatch() == 2);
+	ASSERT(GetLog() == "R 5 done\nR 6 pong\n");
+}
+
+TEST_CASE(RLM3_FwCommand_ParseThroughput)
+{
+	InitCommands();
+	ASSERT(RLM3_FwCommand_Register("echo", EchoCommand));
+
+	const char* frame = "C 12 echo first-argument second-argument 12345\n";
+	size_t frame_size = std::strlen(frame);
+	const size_t FRAME_COUNT = 20000;
+
+	size_t dispatched = 0;
+	size_t bytes = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < FRAME_COUNT; i++)
+	{
+		SIM_DoInterrupt([=] { RLM3_FwCommand_PutFromISR(frame, frame_size); });
+		dispatched += RLM3_FwCommand_Dispatch();
+		bytes += frame_size;
+		EXTERNAL_MEMORY->log_tail = EXTERNAL_MEMORY->log_head;
+	}
+	auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	ASSERT(dispatched == FRAME_COUNT);
+	ASSERT(g_last_args == "echo|first-argument|second-argument|12345|");
+	std::printf("Command parse throughput: %.1f MB/s, %.0f commands/s\n", bytes / elapsed / 1e6, FRAME_COUNT / elapsed);
+}
+
+TEST_CASE(RLM3_FwCommand_RoundTripLatency)
+{
+	InitCommands();
+
+	// Simulate a 115200 baud link (about 11 bytes per ms) with the comm task dispatching once per ms.
+	const size_t BYTES_PER_MS = 11;
+	const char* frame = "C 9 ping\n";
+	size_t frame_size = std::strlen(frame);
+
+	RLM3_Time worst_latency = 0;
+	for (size_t round = 0; round < 100; round++)
+	{
+		EXTERNAL_MEMORY->log_tail = EXTERNAL_MEMORY->log_head;
+		RLM3_Time send_time = RLM3_GetCurrentTime();
+		size_t sent = 0;
+		while (GetLog() != "R 9 pong\n")
+		{
+			SIM_DoInterrupt([&] {
+				for (size_t i = 0; i < BYTES_PER_MS && sent < frame_size; i++)
+					RLM3_FwCommand_PutCharFromISR(frame[sent++]);
+			});
+			RLM3_FwCommand_Dispatch();
+			RLM3_Delay(1);
+			ASSERT(RLM3_GetCurrentTime() - send_time < 100);
+		}
+		RLM3_Time latency = RLM3_GetCurrentTime() - send_time;
+		if (latency > worst_latency)
+			worst_latency = latency;
+	}
+
+	ASSERT(worst_latency <= 2);
+	std::printf("Command round trip latency: worst %u ms\n", (unsigned)worst_latency);
+}
+
+TEST_TEARDOWN(FW_COMMAND_TEARDOWN)
+{
+	if (RLM3_FwCommand_IsInit())
+		RLM3_FwCommand_Deinit();
+}
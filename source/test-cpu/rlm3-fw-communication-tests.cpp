@@ -2,12 +2,74 @@
 #include "rlm3-fw-communication.h"
 #include "rlm3-log-buffer.h"
 #include "rlm3-timer.h"
+#include "rlm3-timer-ext-sim.hpp"
 #include "rlm3-memory.h"
 #include "rlm3-settings.h"
+#include "rlm3-task.h"
 #include "rlm3-sim.hpp"
+#include <cstdio>
+#include <sstream>
+#include <string>
 
 
 static constexpr size_t LOG_BUFFER_SIZE = sizeof(ExternalMemoryLayout::log_buffer);
+static constexpr size_t DRAIN_TICKS_PER_MS = 10;
+
+
+static std::string GetUnsentLog(uint32_t start)
+{
+	std::string result;
+	for (uint32_t i = start; i != EXTERNAL_MEMORY->log_head; i++)
+		result += EXTERNAL_MEMORY->log_buffer[i % LOG_BUFFER_SIZE];
+	return result;
+}
+
+static std::string GetUnsentConsoleOutput(uint32_t start)
+{
+	// The console leaves out the intern definitions and shows names in place of ids.
+	std::string log = GetUnsentLog(start);
+	std::string result;
+	for (size_t line_start = 0; line_start < log.size(); )
+	{
+		size_t line_end = log.find('\n', line_start) + 1;
+		std::string line = log.substr(line_start, line_end - line_start);
+		line_start = line_end;
+		char type = line[0];
+		if (type == 'I')
+			continue;
+		if (type == 'l' || type == 'd')
+		{
+			std::istringstream fields(line.substr(2));
+			std::string time, level, zone;
+			if (type == 'l')
+				fields >> time;
+			fields >> level;
+			if (type == 'l')
+				fields >> zone;
+			std::string names = RLM3_LogBuffer_GetInternName(std::stoul(level));
+			if (type == 'l')
+				names = time + " " + names + " " + RLM3_LogBuffer_GetInternName(std::stoul(zone));
+			fields.get();
+			std::string rest;
+			std::getline(fields, rest);
+			line = std::string(1, type == 'l' ? 'L' : 'D') + " " + names + " " + rest + "\n";
+		}
+		result += line;
+	}
+	return result;
+}
+
+static size_t RunDrainTicks(size_t max_ticks)
+{
+	// The timer only interrupts while the firmware has its interrupt enabled.
+	size_t ticks = 0;
+	while (SIM_Timer2_IsInterruptEnabled() && ticks < max_ticks)
+	{
+		SIM_DoInterrupt([] { RLM3_Timer2_Event_Callback(); });
+		ticks++;
+	}
+	return ticks;
+}
 
 
 TEST_CASE(RLM3_FwCommunication_Init_HappyCase)
@@ -16,13 +78,31 @@ TEST_CASE(RLM3_FwCommunication_Init_HappyCase)
 
 	RLM3_FwCommunication_Init();
 
+	ASSERT(RLM3_FwCommunication_IsInit());
 	ASSERT(RLM3_LogBuffer_IsInit());
 	ASSERT(RLM3_Timer2_IsInit());
+	ASSERT(!RLM3_FwCommunication_IsDrainArmed()); // Nothing to send yet.
+	ASSERT(!SIM_Timer2_IsInterruptEnabled());
 
 	RLM3_FwCommunication_Deinit();
 
+	ASSERT(!RLM3_FwCommunication_IsInit());
 	ASSERT(!RLM3_LogBuffer_IsInit());
 	ASSERT(!RLM3_Timer2_IsInit());
+	ASSERT(!RLM3_FwCommunication_IsDrainArmed());
+}
+
+TEST_CASE(RLM3_FwCommunication_Init_AlreadyInitialized)
+{
+	RLM3_MEMORY_Init();
+	RLM3_FwCommunication_Init();
+
+	ASSERT_ASSERTS(RLM3_FwCommunication_Init());
+}
+
+TEST_CASE(RLM3_FwCommunication_Deinit_NeverInitialized)
+{
+	ASSERT_ASSERTS(RLM3_FwCommunication_Deinit());
 }
 
 TEST_CASE(RLM3_FwCommunication_SendNone)
@@ -44,9 +124,10 @@ TEST_CASE(RLM3_FwCommunication_SendOne)
 	RLM3_MEMORY_Init();
 	EXTERNAL_MEMORY->log_magic = 0x4C4F474D;
 	EXTERNAL_MEMORY->log_tail = 0x12345678;
-	EXTERNAL_MEMORY->log_head = 0x12345678 + 1;
+	EXTERNAL_MEMORY->log_head = 0x12345678 + 2;
 	EXTERNAL_MEMORY->log_buffer[0x12345678 % LOG_BUFFER_SIZE] = 'a';
-	SIM_ExpectDebugOutput("a");
+	EXTERNAL_MEMORY->log_buffer[0x12345679 % LOG_BUFFER_SIZE] = '\n';
+	SIM_ExpectDebugOutput("a\n");
 	RLM3_FwCommunication_Init();
 
 	SIM_DoInterrupt([] { RLM3_Timer2_Event_Callback(); });
@@ -60,21 +141,242 @@ TEST_CASE(RLM3_FwCommunication_SkipOne)
 	RLM3_MEMORY_Init();
 	EXTERNAL_MEMORY->log_magic = 0x4C4F474D;
 	EXTERNAL_MEMORY->log_tail = 0x12345678;
-	EXTERNAL_MEMORY->log_head = 0x12345678 + 2;
+	EXTERNAL_MEMORY->log_head = 0x12345678 + 4;
 	EXTERNAL_MEMORY->log_buffer[0x12345678 % LOG_BUFFER_SIZE] = 'a';
-	EXTERNAL_MEMORY->log_buffer[0x12345679 % LOG_BUFFER_SIZE] = 'b';
-	SIM_ExpectDebugOutput("b");
+	EXTERNAL_MEMORY->log_buffer[0x12345679 % LOG_BUFFER_SIZE] = '\n';
+	EXTERNAL_MEMORY->log_buffer[0x1234567A % LOG_BUFFER_SIZE] = 'b';
+	EXTERNAL_MEMORY->log_buffer[0x1234567B % LOG_BUFFER_SIZE] = '\n';
+	SIM_ExpectDebugOutput("b\n");
 	RLM3_FwCommunication_Init();
 
-	EXTERNAL_MEMORY->log_tail++;
+	EXTERNAL_MEMORY->log_tail += 2;
 	SIM_DoInterrupt([] { RLM3_Timer2_Event_Callback(); });
 	SIM_DoInterrupt([] { RLM3_Timer2_Event_Callback(); });
 
 	RLM3_FwCommunication_Deinit();
 }
 
+TEST_CASE(RLM3_FwCommunication_ArmOnLog)
+{
+	RLM3_MEMORY_Init();
+	SIM_ExpectDebugOutput("abc\n");
+	RLM3_FwCommunication_Init();
+
+	RLM3_LogBuffer_FormatRawMessage("abc");
+	ASSERT(RLM3_FwCommunication_IsDrainArmed());
+	ASSERT(SIM_Timer2_IsInterruptEnabled());
+
+	size_t ticks = RunDrainTicks(100);
+
+	ASSERT(ticks == 4);
+	ASSERT(!RLM3_FwCommunication_IsDrainArmed());
+	ASSERT(!SIM_Timer2_IsInterruptEnabled());
+}
+
+TEST_CASE(RLM3_FwCommunication_ArmOnDebugChar)
+{
+	RLM3_MEMORY_Init();
+	SIM_ExpectDebugOutput("D test a\n");
+	RLM3_FwCommunication_Init();
+
+	RLM3_LogBuffer_DebugChar("test", 'a');
+	ASSERT(!SIM_Timer2_IsInterruptEnabled()); // The line is not published until it ends.
+	RLM3_LogBuffer_DebugChar("test", '\n');
+	ASSERT(SIM_Timer2_IsInterruptEnabled());
+
+	RunDrainTicks(100);
+
+	ASSERT(!RLM3_FwCommunication_IsDrainArmed());
+}
+
+TEST_CASE(RLM3_FwCommunication_ArmOnExistingLog)
+{
+	RLM3_MEMORY_Init();
+	EXTERNAL_MEMORY->log_magic = 0x4C4F474D;
+	EXTERNAL_MEMORY->log_tail = 0x12345678;
+	EXTERNAL_MEMORY->log_head = 0x12345678 + 2;
+	EXTERNAL_MEMORY->log_buffer[0x12345678 % LOG_BUFFER_SIZE] = 'a';
+	EXTERNAL_MEMORY->log_buffer[0x12345679 % LOG_BUFFER_SIZE] = '\n';
+	SIM_ExpectDebugOutput("a\n");
+
+	RLM3_FwCommunication_Init();
+
+	ASSERT(SIM_Timer2_IsInterruptEnabled());
+	ASSERT(RunDrainTicks(100) == 2);
+	ASSERT(!RLM3_FwCommunication_IsDrainArmed());
+}
+
+TEST_CASE(RLM3_FwCommunication_Deinit_WhileArmed)
+{
+	RLM3_MEMORY_Init();
+	RLM3_FwCommunication_Init();
+	RLM3_LogBuffer_FormatRawMessage("abc");
+	ASSERT(SIM_Timer2_IsInterruptEnabled());
+
+	RLM3_FwCommunication_Deinit();
+
+	ASSERT(!SIM_Timer2_IsInterruptEnabled());
+	ASSERT(!RLM3_Timer2_IsInit());
+}
+
+TEST_CASE(RLM3_FwCommunication_DebugConsoleFilter)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogSink_Filter filter = { RLM3_LOGSINK_LEVEL_WARN, NULL, 0, true, 0, 0 };
+	RLM3_FwCommunication_SetDebugConsoleFilter(&filter);
+	SIM_ExpectDebugOutput("L 0 WARN ZONE shown\n");
+	RLM3_FwCommunication_Init();
+
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "hidden");
+	RLM3_LogBuffer_FormatLogMessage("WARN", "ZONE", "shown");
+	RLM3_LogBuffer_FormatRawMessage("R 1 hidden");
+	RunDrainTicks(100);
+
+	// Everything is still in the log for the other sinks.
+	ASSERT(!RLM3_FwCommunication_IsDrainArmed());
+	ASSERT(EXTERNAL_MEMORY->log_tail == 0);
+	ASSERT(GetUnsentLog(0) == "I 0 INFO\nI 1 ZONE\nl 0 0 1 hidden\nI 2 WARN\nl 0 2 1 shown\nR 1 hidden\n");
+}
+
+TEST_CASE(RLM3_FwCommunication_RateLimitThrottlesDrain)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogSink_Filter filter = { RLM3_LOGSINK_LEVEL_TRACE, NULL, 0, false, 1000, 50 };
+	RLM3_FwCommunication_SetDebugConsoleFilter(&filter);
+	RLM3_FwCommunication_Init();
+	for (size_t i = 0; i < 20; i++)
+		RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "message %u", (unsigned)i);
+	std::string expected = GetUnsentConsoleOutput(0);
+	SIM_ExpectDebugOutput(expected.c_str());
+
+	// The timer interrupts 10 times per ms, except that a throttled drain waits at least 1 ms for the budget.
+	size_t ticks = 0;
+	size_t ms = 0;
+	while (SIM_Timer2_IsInterruptEnabled() && ms < 10000)
+	{
+		for (size_t i = 0; i < DRAIN_TICKS_PER_MS && SIM_Timer2_IsInterruptEnabled(); i++)
+		{
+			SIM_DoInterrupt([] { RLM3_Timer2_Event_Callback(); });
+			ticks++;
+			if (RLM3_FwCommunication_IsDrainThrottled())
+			{
+				ASSERT(SIM_Timer2_GetPeriod() >= 1000 && SIM_Timer2_GetPeriod() % 1000 == 0);
+				break;
+			}
+		}
+		RLM3_Delay(1);
+		ms++;
+	}
+
+	ASSERT(!RLM3_FwCommunication_IsDrainArmed());
+	ASSERT(!RLM3_FwCommunication_IsDrainThrottled());
+	ASSERT(ms >= (expected.size() - 50));
+	ASSERT(ticks < 2 * ms);
+}
+
+TEST_CASE(RLM3_FwCommunication_ThrottledPeriod)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogSink_Filter filter = { RLM3_LOGSINK_LEVEL_TRACE, NULL, 0, false, 1000, 10 };
+	RLM3_FwCommunication_SetDebugConsoleFilter(&filter);
+	RLM3_FwCommunication_Init();
+	ASSERT(SIM_Timer2_GetPeriod() == 100);
+	SIM_ExpectDebugOutput("aaaaaaaaa\nbbbbbbbbb\n");
+
+	// The first record uses up the burst.  The second needs 10 ms of budget at one byte per ms, so the next interrupt
+	// waits for it.
+	RLM3_LogBuffer_FormatRawMessage("aaaaaaaaa");
+	RLM3_LogBuffer_FormatRawMessage("bbbbbbbbb");
+	size_t ticks = 0;
+	while (!RLM3_FwCommunication_IsDrainThrottled() && ticks < 100)
+		ticks += RunDrainTicks(1);
+	ASSERT(ticks == 11);
+	ASSERT(SIM_Timer2_GetPeriod() == 10000);
+
+	RLM3_Delay(10);
+	RunDrainTicks(100);
+	ASSERT(!RLM3_FwCommunication_IsDrainArmed());
+	ASSERT(!RLM3_FwCommunication_IsDrainThrottled());
+	ASSERT(SIM_Timer2_GetPeriod() == 100);
+}
+
+TEST_CASE(RLM3_FwCommunication_InterruptsPerByte_Idle)
+{
+	RLM3_MEMORY_Init();
+	SIM_ExpectDebugOutput("");
+	RLM3_FwCommunication_Init();
+
+	// A free running timer would interrupt 10 times per ms here.
+	size_t ticks = 0;
+	for (size_t ms = 0; ms < 1000; ms++)
+	{
+		ticks += RunDrainTicks(DRAIN_TICKS_PER_MS);
+		RLM3_Delay(1);
+	}
+
+	ASSERT(ticks == 0);
+	std::printf("Debug console idle: %zu interrupts in 1000 ms\n", ticks);
+}
+
+TEST_CASE(RLM3_FwCommunication_InterruptsPerByte_Bursty)
+{
+	RLM3_MEMORY_Init();
+	RLM3_FwCommunication_Init();
+
+	// Bursts of messages separated by quiet periods.
+	size_t ticks = 0;
+	size_t bytes = 0;
+	for (size_t burst = 0; burst < 10; burst++)
+	{
+		uint32_t start = EXTERNAL_MEMORY->log_head;
+		for (size_t i = 0; i < 20; i++)
+			RLM3_LogBuffer_FormatLogMessage("INFO", "BURST", "message %u in burst %u", (unsigned)i, (unsigned)burst);
+		std::string expected = GetUnsentConsoleOutput(start);
+		SIM_ExpectDebugOutput(expected.c_str());
+		bytes += expected.size();
+		for (size_t ms = 0; ms < 100; ms++)
+		{
+			ticks += RunDrainTicks(DRAIN_TICKS_PER_MS);
+			RLM3_Delay(1);
+		}
+		ASSERT(!RLM3_FwCommunication_IsDrainArmed());
+	}
+
+	double ratio = (double)ticks / bytes;
+	ASSERT(ratio < 0.25);
+	std::printf("Debug console bursty: %zu interrupts for %zu bytes (%.3f per byte)\n", ticks, bytes, ratio);
+}
+
+TEST_CASE(RLM3_FwCommunication_InterruptsPerByte_Sustained)
+{
+	RLM3_MEMORY_Init();
+	RLM3_FwCommunication_Init();
+
+	// One message every ms with the console keeping up.
+	size_t ticks = 0;
+	size_t bytes = 0;
+	for (size_t ms = 0; ms < 1000; ms++)
+	{
+		uint32_t start = EXTERNAL_MEMORY->log_head;
+		RLM3_LogBuffer_FormatLogMessage("INFO", "SUSTAINED", "message %u", (unsigned)ms);
+		std::string expected = GetUnsentConsoleOutput(start);
+		SIM_ExpectDebugOutput(expected.c_str());
+		bytes += expected.size();
+		ticks += RunDrainTicks(DRAIN_TICKS_PER_MS);
+		RLM3_Delay(1);
+	}
+	ticks += RunDrainTicks(LOG_BUFFER_SIZE);
+
+	double ratio = (double)ticks / bytes;
+	ASSERT(!RLM3_FwCommunication_IsDrainArmed());
+	ASSERT(ratio < 0.5);
+	std::printf("Debug console sustained: %zu interrupts for %zu bytes (%.3f per byte)\n", ticks, bytes, ratio);
+}
+
 TEST_TEARDOWN(FW_COMM_TEARDOWN)
 {
-	if (RLM3_Timer2_IsInit())
+	if (RLM3_FwCommunication_IsInit())
 		RLM3_FwCommunication_Deinit();
+	RLM3_LogSink_Filter filter = { RLM3_LOGSINK_LEVEL_TRACE, NULL, 0, false, 0, 0 };
+	RLM3_FwCommunication_SetDebugConsoleFilter(&filter);
 }
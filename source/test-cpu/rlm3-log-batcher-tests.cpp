@@ -0,0 +1,420 @@
+#include "Test.hpp"
+#include "rlm3-log-batcher.h"
+#include "rlm3-log-buffer.h"
+#include "rlm3-log-decoder.hpp"
+#include "rlm3-memory.h"
+#include "rlm3-settings.h"
+#include "rlm3-task.h"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+static const RLM3_LogSink_Filter PASS_ALL = { RLM3_LOGSINK_LEVEL_TRACE, NULL, 0, false, 0, 0 };
+
+
+static std::string ReadBatch(RLM3_LogBatcher* batcher)
+{
+	std::string result;
+	const char* data;
+	while (size_t size = RLM3_LogBatcher_Peek(batcher, &data))
+	{
+		result.append(data, size);
+		RLM3_LogBatcher_Consume(batcher, size);
+	}
+	return result;
+}
+
+struct SimulatedLinkResult
+{
+	double throughput;
+	RLM3_Time p99_latency;
+	RLM3_Time worst_error_latency;
+	size_t batch_count;
+};
+
+static SimulatedLinkResult RunSimulatedLink(RLM3_Time one_way_latency, uint32_t bytes_per_second, size_t records_per_second, RLM3_Time duration)
+{
+	RLM3_LogBatcher batcher;
+	RLM3_LogBatcher_Init(&batcher, &PASS_ALL);
+
+	SimulatedLinkResult result = {};
+	std::vector<RLM3_Time> latencies;
+	uint32_t random = 12345;
+	bool is_sending = false;
+	std::string batch;
+	RLM3_Time ack_time = 0;
+	size_t delivered_bytes = 0;
+	LogInternTable table;
+	RLM3_Time start_time = RLM3_GetCurrentTime();
+
+	for (RLM3_Time ms = 0; ms < duration; ms++)
+	{
+		// Produce records at about the requested rate with an occasional error.
+		random = random * 1103515245 + 12345;
+		if ((random >> 16) % 1000 < records_per_second)
+		{
+			if ((random >> 8) % 97 == 0)
+				RLM3_LogBuffer_FormatLogMessage("ERROR", "SIM", "something went wrong %u", (unsigned)ms);
+			else
+				RLM3_LogBuffer_FormatLogMessage("INFO", "SIM", "periodic status %u value %u", (unsigned)ms, (unsigned)(random & 0xFFFF));
+		}
+
+		// Deliver the batch in flight once the link has carried it and the acknowledgement came back.
+		RLM3_Time now = RLM3_GetCurrentTime();
+		if (is_sending && now >= ack_time)
+		{
+			std::string line;
+			for (char c : batch)
+			{
+				if (c != '\n')
+				{
+					line += c;
+					continue;
+				}
+				LogRecord record;
+				ParseLogRecord(line, 0, &record, &table);
+				line.clear();
+				if (record.type != LogRecordType::LOG)
+					continue;
+				RLM3_Time latency = now - record.time;
+				latencies.push_back(latency);
+				if (record.level == "ERROR")
+					result.worst_error_latency = std::max(result.worst_error_latency, latency);
+			}
+			delivered_bytes += batch.size();
+			RLM3_LogBatcher_Acknowledge(&batcher);
+			is_sending = false;
+		}
+		if (!is_sending && RLM3_LogBatcher_Poll(&batcher))
+		{
+			is_sending = true;
+			batch = ReadBatch(&batcher);
+			ack_time = now + 2 * one_way_latency + (RLM3_Time)(1000 * (uint64_t)batch.size() / bytes_per_second);
+			result.batch_count++;
+		}
+		RLM3_Delay(1);
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	ASSERT(!latencies.empty());
+	result.p99_latency = latencies[latencies.size() * 99 / 100];
+	result.throughput = delivered_bytes * 1000.0 / (RLM3_GetCurrentTime() - start_time);
+	return result;
+}
+
+
+TEST_CASE(RLM3_LogBatcher_Init_NotInitialized)
+{
+	RLM3_LogBatcher batcher;
+	ASSERT_ASSERTS(RLM3_LogBatcher_Init(&batcher, &PASS_ALL));
+}
+
+TEST_CASE(RLM3_LogBatcher_Poll_Empty)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBatcher batcher;
+	RLM3_LogBatcher_Init(&batcher, &PASS_ALL);
+
+	ASSERT(!RLM3_LogBatcher_Poll(&batcher));
+	RLM3_Delay(1000);
+	ASSERT(!RLM3_LogBatcher_Poll(&batcher));
+}
+
+TEST_CASE(RLM3_LogBatcher_Poll_WaitsForDeadline)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBatcher batcher;
+	RLM3_LogBatcher_Init(&batcher, &PASS_ALL);
+
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "small");
+	ASSERT(!RLM3_LogBatcher_Poll(&batcher));
+	RLM3_Time wait = RLM3_LogBatcher_GetWaitTime(&batcher);
+	ASSERT(wait == batcher.max_delay);
+
+	RLM3_Delay(wait - 1);
+	ASSERT(!RLM3_LogBatcher_Poll(&batcher));
+	RLM3_Delay(1);
+	ASSERT(RLM3_LogBatcher_Poll(&batcher));
+	ASSERT(ReadBatch(&batcher).size() == EXTERNAL_MEMORY->log_head);
+}
+
+TEST_CASE(RLM3_LogBatcher_Poll_FullBatch)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBatcher batcher;
+	RLM3_LogBatcher_Init(&batcher, &PASS_ALL);
+
+	while (EXTERNAL_MEMORY->log_head < 2 * batcher.target_size)
+		RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "filling the batch");
+
+	ASSERT(RLM3_LogBatcher_Poll(&batcher));
+	std::string batch = ReadBatch(&batcher);
+	ASSERT(!batch.empty() && batch.size() <= batcher.target_size);
+	ASSERT(batch.back() == '\n');
+}
+
+TEST_CASE(RLM3_LogBatcher_Poll_LongRecord)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBatcher batcher;
+	RLM3_LogBatcher_Init(&batcher, &PASS_ALL);
+	RLM3_LogBuffer_FormatLogMessage("ERROR", "ZONE", "first");
+	std::string text(2 * batcher.target_size, 'x');
+	RLM3_LogBuffer_FormatLogMessage("ERROR", "ZONE", "%s", text.c_str());
+	RLM3_LogBuffer_FormatLogMessage("ERROR", "ZONE", "next");
+
+	// A record bigger than the target does not join a batch that has started, and goes out whole on its own.
+	ASSERT(RLM3_LogBatcher_Poll(&batcher));
+	ASSERT(ReadBatch(&batcher).find(text) == std::string::npos);
+	RLM3_LogBatcher_Acknowledge(&batcher);
+	ASSERT(RLM3_LogBatcher_Poll(&batcher));
+	std::string batch = ReadBatch(&batcher);
+	ASSERT(batch.find(text) != std::string::npos);
+	ASSERT(batch.find("next") == std::string::npos);
+	ASSERT(batch.back() == '\n');
+}
+
+TEST_CASE(RLM3_LogBatcher_Poll_UrgentRecord)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBatcher batcher;
+	RLM3_LogBatcher_Init(&batcher, &PASS_ALL);
+
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "not urgent");
+	ASSERT(!RLM3_LogBatcher_Poll(&batcher));
+	RLM3_LogBuffer_FormatLogMessage("FATAL", "ZONE", "urgent");
+	ASSERT(RLM3_LogBatcher_GetWaitTime(&batcher) != 0); // The new record has not been scanned yet.
+	ASSERT(RLM3_LogBatcher_Poll(&batcher));
+	ASSERT(ReadBatch(&batcher).size() == EXTERNAL_MEMORY->log_head);
+}
+
+TEST_CASE(RLM3_LogBatcher_Poll_PreviousSession)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "old");
+	uint32_t old_head = EXTERNAL_MEMORY->log_head;
+	RLM3_LogBuffer_Deinit();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FormatLogMessage("FATAL", "ZONE", "defines the ids");
+	EXTERNAL_MEMORY->log_head = old_head; // Keep only the old record, whose level id now means FATAL.
+	RLM3_LogBatcher batcher;
+	RLM3_LogBatcher_Init(&batcher, &PASS_ALL);
+
+	ASSERT(!RLM3_LogBatcher_Poll(&batcher));
+}
+
+TEST_CASE(RLM3_LogBatcher_Poll_Filtered)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	static const char* const ZONES[] = { "KEEP" };
+	RLM3_LogSink_Filter filter = { RLM3_LOGSINK_LEVEL_INFO, ZONES, 1, true, 0, 0 };
+	RLM3_LogBatcher batcher;
+	RLM3_LogBatcher_Init(&batcher, &filter);
+	RLM3_LogBuffer_FormatLogMessage("ERROR", "DROP", "other zone");
+	RLM3_LogBuffer_FormatLogMessage("DEBUG", "KEEP", "too verbose");
+	RLM3_LogBuffer_FormatLogMessage("ERROR", "KEEP", "sent");
+	RLM3_LogBuffer_FormatRawMessage("raw");
+
+	ASSERT(RLM3_LogBatcher_Poll(&batcher));
+	std::string batch = ReadBatch(&batcher);
+	ASSERT(batch.find("sent") != std::string::npos);
+	ASSERT(batch.find("other zone") == std::string::npos);
+	ASSERT(batch.find("too verbose") == std::string::npos);
+	ASSERT(batch.find("raw") == std::string::npos);
+
+	// Skipped records are released along with the batch.
+	RLM3_LogBatcher_Acknowledge(&batcher);
+	ASSERT(EXTERNAL_MEMORY->log_tail == EXTERNAL_MEMORY->log_head);
+}
+
+TEST_CASE(RLM3_LogBatcher_Poll_AllFiltered)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogSink_Filter filter = { RLM3_LOGSINK_LEVEL_FATAL, NULL, 0, false, 0, 0 };
+	RLM3_LogBatcher batcher;
+	RLM3_LogBatcher_Init(&batcher, &filter);
+	RLM3_LogBuffer_FormatLogMessage("ERROR", "ZONE", "only sends the definitions");
+	ASSERT(RLM3_LogBatcher_Poll(&batcher));
+	ASSERT(ReadBatch(&batcher).find("definitions") == std::string::npos);
+	RLM3_LogBatcher_Acknowledge(&batcher);
+	RLM3_LogBuffer_FormatLogMessage("ERROR", "ZONE", "urgent but filtered");
+
+	// Nothing is sent, but the skipped data is released and the batcher goes idle.
+	ASSERT(!RLM3_LogBatcher_Poll(&batcher));
+	ASSERT(EXTERNAL_MEMORY->log_tail == EXTERNAL_MEMORY->log_head);
+	ASSERT(RLM3_LogBatcher_GetWaitTime(&batcher) == batcher.max_delay);
+}
+
+TEST_CASE(RLM3_LogBatcher_Poll_RateLimited)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogSink_Filter filter = { RLM3_LOGSINK_LEVEL_TRACE, NULL, 0, false, 1000, 100 };
+	RLM3_LogBatcher batcher;
+	RLM3_LogBatcher_Init(&batcher, &filter);
+	std::string text(60, 'x');
+	RLM3_LogBuffer_FormatLogMessage("ERROR", "ZONE", "%s", text.c_str());
+	RLM3_LogBuffer_FormatLogMessage("ERROR", "ZONE", "%s", text.c_str());
+
+	// The burst covers the first record and the second waits for its tokens.
+	ASSERT(RLM3_LogBatcher_Poll(&batcher));
+	std::string batch = ReadBatch(&batcher);
+	ASSERT(batch.find(text) == batch.rfind(text));
+	RLM3_LogBatcher_Acknowledge(&batcher);
+	RLM3_Time wait = RLM3_LogBatcher_GetWaitTime(&batcher);
+	ASSERT(wait != 0);
+	ASSERT(!RLM3_LogBatcher_Poll(&batcher));
+
+	RLM3_Delay(wait);
+	ASSERT(RLM3_LogBatcher_Poll(&batcher));
+	ASSERT(ReadBatch(&batcher).find(text) != std::string::npos);
+	RLM3_LogBatcher_Acknowledge(&batcher);
+	ASSERT(EXTERNAL_MEMORY->log_tail == EXTERNAL_MEMORY->log_head);
+}
+
+TEST_CASE(RLM3_LogBatcher_Acknowledge_ReleasesData)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBatcher batcher;
+	RLM3_LogBatcher_Init(&batcher, &PASS_ALL);
+	RLM3_LogBuffer_FormatLogMessage("ERROR", "ZONE", "message");
+	uint32_t first_end = EXTERNAL_MEMORY->log_head;
+	ASSERT(RLM3_LogBatcher_Poll(&batcher));
+	ReadBatch(&batcher);
+
+	// Only one batch is in flight at a time.
+	RLM3_LogBuffer_FormatLogMessage("ERROR", "ZONE", "another");
+	ASSERT(!RLM3_LogBatcher_Poll(&batcher));
+	ASSERT(EXTERNAL_MEMORY->log_tail == 0);
+
+	RLM3_Delay(10);
+	RLM3_LogBatcher_Acknowledge(&batcher);
+	ASSERT(EXTERNAL_MEMORY->log_tail == first_end);
+	ASSERT(RLM3_LogBatcher_Poll(&batcher));
+	ASSERT(ReadBatch(&batcher).size() == EXTERNAL_MEMORY->log_head - first_end);
+}
+
+TEST_CASE(RLM3_LogBatcher_Acknowledge_SlowestRetainer)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBatcher batcher;
+	RLM3_LogBatcher_Init(&batcher, &PASS_ALL);
+	RLM3_LogSink other;
+	RLM3_LogSink_Init(&other, &PASS_ALL);
+	RLM3_LogSink_SetRetaining(&other, true);
+	RLM3_LogBuffer_FormatLogMessage("ERROR", "ZONE", "message");
+	ASSERT(RLM3_LogBatcher_Poll(&batcher));
+	ReadBatch(&batcher);
+
+	// The other sink has not read anything, so the tail stays put.
+	RLM3_LogBatcher_Acknowledge(&batcher);
+	ASSERT(EXTERNAL_MEMORY->log_tail == 0);
+
+	const char* data;
+	size_t size = RLM3_LogSink_Peek(&other, &data);
+	RLM3_LogSink_Consume(&other, size);
+	RLM3_LogSink_Release(&other, other.cursor);
+	ASSERT(EXTERNAL_MEMORY->log_tail == EXTERNAL_MEMORY->log_head);
+	RLM3_LogSink_SetRetaining(&other, false);
+	RLM3_LogBatcher_Deinit(&batcher);
+}
+
+TEST_CASE(RLM3_LogBatcher_Acknowledge_RestartsDeadline)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBatcher batcher;
+	RLM3_LogBatcher_Init(&batcher, &PASS_ALL);
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "first");
+	ASSERT(!RLM3_LogBatcher_Poll(&batcher));
+	RLM3_Delay(batcher.max_delay);
+	ASSERT(RLM3_LogBatcher_Poll(&batcher));
+	ReadBatch(&batcher);
+
+	RLM3_Delay(10);
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "second");
+	RLM3_Delay(10);
+	RLM3_LogBatcher_Acknowledge(&batcher);
+
+	// The deadline follows the oldest record left, not the batch that was just sent.
+	ASSERT(RLM3_LogBatcher_GetWaitTime(&batcher) == batcher.max_delay - 10);
+	ASSERT(!RLM3_LogBatcher_Poll(&batcher));
+}
+
+TEST_CASE(RLM3_LogBatcher_Abort_Resends)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBatcher batcher;
+	RLM3_LogBatcher_Init(&batcher, &PASS_ALL);
+	RLM3_LogBuffer_FormatLogMessage("ERROR", "ZONE", "message");
+	ASSERT(RLM3_LogBatcher_Poll(&batcher));
+	std::string batch = ReadBatch(&batcher);
+
+	RLM3_LogBatcher_Abort(&batcher);
+	ASSERT(RLM3_LogBatcher_Poll(&batcher));
+
+	ASSERT(ReadBatch(&batcher) == batch);
+	ASSERT(EXTERNAL_MEMORY->log_tail == 0);
+}
+
+TEST_CASE(RLM3_LogBatcher_Acknowledge_NotInFlight)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBatcher batcher;
+	RLM3_LogBatcher_Init(&batcher, &PASS_ALL);
+
+	ASSERT_ASSERTS(RLM3_LogBatcher_Acknowledge(&batcher));
+	ASSERT_ASSERTS(RLM3_LogBatcher_Abort(&batcher));
+}
+
+TEST_CASE(RLM3_LogBatcher_Acknowledge_NotRead)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBatcher batcher;
+	RLM3_LogBatcher_Init(&batcher, &PASS_ALL);
+	RLM3_LogBuffer_FormatLogMessage("ERROR", "ZONE", "message");
+	ASSERT(RLM3_LogBatcher_Poll(&batcher));
+
+	ASSERT_ASSERTS(RLM3_LogBatcher_Acknowledge(&batcher));
+}
+
+TEST_CASE(RLM3_LogBatcher_SimulatedLink_Fast)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+
+	// Wifi-like link: 5 ms each way, 1 MB/s, 200 records per second.
+	SimulatedLinkResult result = RunSimulatedLink(5, 1000000, 200, 20000);
+
+	ASSERT(result.p99_latency <= 250);
+	ASSERT(result.worst_error_latency <= 50);
+	std::printf("Log batcher fast link: %.0f B/s, p99 latency %u ms, worst error latency %u ms, %zu batches\n", result.throughput, (unsigned)result.p99_latency, (unsigned)result.worst_error_latency, result.batch_count);
+}
+
+TEST_CASE(RLM3_LogBatcher_SimulatedLink_Slow)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+
+	// Cellular-like link: 100 ms each way, 20 kB/s, 100 records per second.
+	SimulatedLinkResult result = RunSimulatedLink(100, 20000, 100, 20000);
+
+	std::printf("Log batcher slow link: %.0f B/s, p99 latency %u ms, worst error latency %u ms, %zu batches\n", result.throughput, (unsigned)result.p99_latency, (unsigned)result.worst_error_latency, result.batch_count);
+	ASSERT(result.p99_latency <= 600);
+	ASSERT(result.worst_error_latency <= 600);
+}
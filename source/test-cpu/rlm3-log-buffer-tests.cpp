@@ -6,7 +6,12 @@
 #include "rlm3-sim.hpp"
 #include <cstring>
 #include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
 #include <limits>
+#include <string>
+#include <vector>
 
 
 static constexpr size_t BUFFER_SIZE = sizeof(ExternalMemoryLayout::log_buffer);
@@ -92,7 +97,7 @@ TEST_CASE(RLM3_LogBuffer_WriteLogMessage_HappyCase)
 	RLM3_Delay(30);
 	RLM3_LogBuffer_FormatLogMessage("test-level", "test-zone", "test-message %X", 0xACE);
 
-	const char* expected = "L 30 test-level test-zone test-message ACE\n";
+	const char* expected = "I 0 test-level\nI 1 test-zone\nl 30 0 1 test-message ACE\n";
 	size_t length = std::strlen(expected);
 	ASSERT(EXTERNAL_MEMORY->log_magic == 0x4C4F474D);
 	ASSERT(EXTERNAL_MEMORY->log_tail == 0);
@@ -110,7 +115,7 @@ TEST_CASE(RLM3_LogBuffer_WriteLogMessage_FromISR)
 		RLM3_LogBuffer_FormatLogMessage("test-level", "test-zone", "test-message %X", 0xACE);
 	});
 
-	const char* expected = "L 30 test-level test-zone test-message ACE\n";
+	const char* expected = "I 0 test-level\nI 1 test-zone\nl 30 0 1 test-message ACE\n";
 	size_t length = std::strlen(expected);
 	ASSERT(EXTERNAL_MEMORY->log_magic == 0x4C4F474D);
 	ASSERT(EXTERNAL_MEMORY->log_tail == 0);
@@ -118,9 +123,55 @@ TEST_CASE(RLM3_LogBuffer_WriteLogMessage_FromISR)
 	ASSERT(std::strncmp(EXTERNAL_MEMORY->log_buffer, expected, length) == 0);
 }
 
+static std::string ReadLog()
+{
+	std::string result;
+	for (uint32_t i = EXTERNAL_MEMORY->log_tail; i != EXTERNAL_MEMORY->log_head; i++)
+		result += EXTERNAL_MEMORY->log_buffer[i % BUFFER_SIZE];
+	return result;
+}
+
+TEST_CASE(RLM3_LogBuffer_WriteLogMessage_WrapsInText)
+{
+	RLM3_MEMORY_Init();
+	EXTERNAL_MEMORY->log_magic = 0x4C4F474D;
+	EXTERNAL_MEMORY->log_tail = (uint32_t)(0 - 29);
+	EXTERNAL_MEMORY->log_head = (uint32_t)(0 - 29);
+	RLM3_LogBuffer_Init();
+
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "message %d", 1);
+
+	ASSERT(ReadLog() == "I 0 INFO\nI 1 ZONE\nl 0 0 1 message 1\n");
+	ASSERT(EXTERNAL_MEMORY->log_head == 36 - 29);
+}
+
+TEST_CASE(RLM3_LogBuffer_WriteLogMessage_WrapsInHeader)
+{
+	RLM3_MEMORY_Init();
+	EXTERNAL_MEMORY->log_magic = 0x4C4F474D;
+	EXTERNAL_MEMORY->log_tail = (uint32_t)(0 - 4);
+	EXTERNAL_MEMORY->log_head = (uint32_t)(0 - 4);
+	RLM3_LogBuffer_Init();
+
+	RLM3_LogBuffer_FormatLogMessage("INFO", "two words", "message %d", 1); // Names are written out for a zone with a space.
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "message %d", 2);
+
+	ASSERT(ReadLog() == "L 0 INFO two words message 1\nI 0 INFO\nI 1 ZONE\nl 0 0 1 message 2\n");
+}
+
 TEST_CASE(RLM3_LogBuffer_WriteLogMessage_NotInitialized)
 {
+	RLM3_MEMORY_Init();
+	RLM3_Delay(30);
 	RLM3_LogBuffer_FormatLogMessage("test-level", "test-zone", "test-message %X", 0xACE);
+	ASSERT(EXTERNAL_MEMORY->log_head == 0);
+
+	RLM3_LogBuffer_Init();
+
+	// Staged records keep their names, since ids are only assigned once the log is running.
+	const char* expected = "L 30 test-level test-zone test-message ACE\n";
+	ASSERT(EXTERNAL_MEMORY->log_head == std::strlen(expected));
+	ASSERT(std::strncmp(EXTERNAL_MEMORY->log_buffer, expected, std::strlen(expected)) == 0);
 }
 
 TEST_CASE(RLM3_LogBuffer_WriteRawMessage_HappyCase)
@@ -159,7 +210,69 @@ TEST_CASE(RLM3_LogBuffer_WriteRawMessage_FromISR)
 
 TEST_CASE(RLM3_LogBuffer_WriteRawMessage_NotInitialized)
 {
-	RLM3_LogBuffer_FormatRawMessage("test-message %X", 0xACE);
+	RLM3_MEMORY_Init();
+	SIM_DoInterrupt([] {
+		RLM3_LogBuffer_FormatRawMessage("test-message %X", 0xACE);
+	});
+	RLM3_LogBuffer_FormatRawMessage("second");
+
+	RLM3_LogBuffer_Init();
+
+	const char* expected = "test-message ACE\nsecond\n";
+	ASSERT(EXTERNAL_MEMORY->log_head == std::strlen(expected));
+	ASSERT(std::strncmp(EXTERNAL_MEMORY->log_buffer, expected, std::strlen(expected)) == 0);
+}
+
+TEST_CASE(RLM3_LogBuffer_DebugChar_NotInitialized)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_DebugChar("gps", 'a');
+	RLM3_LogBuffer_DebugChar("gps", '\t');
+	RLM3_LogBuffer_DebugChar("wifi", 'c');
+	RLM3_LogBuffer_DebugChar("wifi", '\n');
+	RLM3_LogBuffer_DebugChar("wifi", 'd');
+
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_DebugChar("wifi", 'e'); // A new line, since Init ends the staged one.
+
+	const char* expected = "D gps a?\nD wifi c\nD wifi d\nI 0 wifi\nd 0 e\n";
+	ASSERT(EXTERNAL_MEMORY->log_head == 27); // The last line has not ended yet.
+	ASSERT(std::strncmp(EXTERNAL_MEMORY->log_buffer, expected, std::strlen(expected)) == 0);
+}
+
+TEST_CASE(RLM3_LogBuffer_DebugChar_NotInitializedReusedChannelBuffer)
+{
+	RLM3_MEMORY_Init();
+	char channel[8] = "aa";
+	RLM3_LogBuffer_DebugChar(channel, 'a');
+	std::strcpy(channel, "bb"); // Same pointer, new channel.
+	RLM3_LogBuffer_DebugChar(channel, 'b');
+	RLM3_LogBuffer_DebugChar("bb", 'c'); // New pointer, same channel.
+	RLM3_LogBuffer_DebugChar("bb", '\n');
+
+	RLM3_LogBuffer_Init();
+
+	const char* expected = "D aa a\nD bb bc\n";
+	ASSERT(EXTERNAL_MEMORY->log_head == std::strlen(expected));
+	ASSERT(std::strncmp(EXTERNAL_MEMORY->log_buffer, expected, std::strlen(expected)) == 0);
+}
+
+TEST_CASE(RLM3_LogBuffer_Staging_Full)
+{
+	RLM3_MEMORY_Init();
+	std::string text(1010, 'x');
+	RLM3_LogBuffer_FormatRawMessage("%s", text.c_str());
+	RLM3_LogBuffer_FormatRawMessage("%s", text.c_str()); // Does not fit.
+	RLM3_LogBuffer_DebugChar("long-channel-name", 'a'); // Does not fit either.
+	RLM3_LogBuffer_FormatRawMessage("%s", "fits");
+
+	RLM3_LogBuffer_Init();
+	RLM3_LogBufferStats stats;
+	RLM3_LogBuffer_GetStats(&stats);
+
+	ASSERT(std::string(EXTERNAL_MEMORY->log_buffer, EXTERNAL_MEMORY->log_head) == text + "\nfits\n");
+	ASSERT(stats.written_bytes == 1011 + 5);
+	ASSERT(stats.dropped_bytes == 1011 + 22);
 }
 
 TEST_CASE(RLM3_LogBuffer_Init_WithFaultError)
@@ -169,12 +282,15 @@ TEST_CASE(RLM3_LogBuffer_Init_WithFaultError)
 	std::strncpy(EXTERNAL_MEMORY->fault_cause, "test-fault-cause", sizeof(EXTERNAL_MEMORY->fault_cause));
 	std::memcpy(EXTERNAL_MEMORY->fault_communication_thread_state, "test-thread-state", sizeof(EXTERNAL_MEMORY->fault_communication_thread_state));
 
+	RLM3_LogBuffer_FormatRawMessage("early");
 	RLM3_LogBuffer_Init();
 
-	// For the test, the output will got to the log, but we don't forward the log to our log buffer.
+	const char* expected = "I 0 FATAL\nI 1 LOG_BUFFER\nl 0 0 1 Forced Restart: 'test-fault-cause' COMM: test-thread-sta\nearly\n"; // The thread state is cut to fit its field.
 	ASSERT(EXTERNAL_MEMORY->log_magic == 0x4C4F474D);
+	ASSERT(EXTERNAL_MEMORY->fault_magic == 0);
 	ASSERT(EXTERNAL_MEMORY->log_tail == 0);
-	ASSERT(EXTERNAL_MEMORY->log_head == 0);
+	ASSERT(EXTERNAL_MEMORY->log_head == std::strlen(expected));
+	ASSERT(std::strncmp(EXTERNAL_MEMORY->log_buffer, expected, std::strlen(expected)) == 0);
 }
 
 TEST_CASE(RLM3_LogBuffer_WriteMessage_MultipleMixed)
@@ -189,7 +305,7 @@ TEST_CASE(RLM3_LogBuffer_WriteMessage_MultipleMixed)
 	RLM3_Delay(30);
 	RLM3_LogBuffer_FormatRawMessage("test-message %X", 0xACE2);
 
-	const char* expected = "test-message ACE\nL 60 test-level test-zone test-message 123\ntest-message ACE2\n";
+	const char* expected = "test-message ACE\nI 0 test-level\nI 1 test-zone\nl 60 0 1 test-message 123\ntest-message ACE2\n";
 	size_t length = std::strlen(expected);
 	ASSERT(EXTERNAL_MEMORY->log_magic == 0x4C4F474D);
 	ASSERT(EXTERNAL_MEMORY->log_tail == 0);
@@ -318,7 +434,7 @@ TEST_CASE(RLM3_LogBuffer_DebugChar_HappyCase)
 	RLM3_LogBuffer_DebugChar("test-channel", 'c');
 	RLM3_LogBuffer_DebugChar("test-channel", '\n');
 
-	const char* expected = "D test-channel abc\n";
+	const char* expected = "I 0 test-channel\nd 0 abc\n";
 	size_t length = std::strlen(expected);
 	ASSERT(EXTERNAL_MEMORY->log_tail == 0);
 	ASSERT(EXTERNAL_MEMORY->log_head == length);
@@ -332,7 +448,7 @@ TEST_CASE(RLM3_LogBuffer_DebugChar_FirstChar)
 
 	RLM3_LogBuffer_DebugChar("test-channel", 'a');
 
-	const char* expected = "D test-channel a\n";
+	const char* expected = "I 0 test-channel\nd 0 a\n";
 	size_t length = std::strlen(expected);
 	ASSERT(EXTERNAL_MEMORY->log_tail == 0);
 	ASSERT(EXTERNAL_MEMORY->log_head == 0); // This line is not available yet.
@@ -347,7 +463,7 @@ TEST_CASE(RLM3_LogBuffer_DebugChar_SecondChar)
 	RLM3_LogBuffer_DebugChar("test-channel", 'a');
 	RLM3_LogBuffer_DebugChar("test-channel", 'b');
 
-	const char* expected = "D test-channel ab\n";
+	const char* expected = "I 0 test-channel\nd 0 ab\n";
 	size_t length = std::strlen(expected);
 	ASSERT(EXTERNAL_MEMORY->log_tail == 0);
 	ASSERT(EXTERNAL_MEMORY->log_head == 0); // This line is not available yet.
@@ -364,10 +480,33 @@ TEST_CASE(RLM3_LogBuffer_DebugChar_TwoChannels)
 	RLM3_LogBuffer_DebugChar("second", 'c');
 	RLM3_LogBuffer_DebugChar("second", 'd');
 
-	const char* expected = "D test-channel ab\nD second cd\n";
+	const char* expected = "I 0 test-channel\nd 0 ab\nI 1 second\nd 1 cd\n";
 	size_t length = std::strlen(expected);
 	ASSERT(EXTERNAL_MEMORY->log_tail == 0);
-	ASSERT(EXTERNAL_MEMORY->log_head == 18); // Only the first line is available yet.
+	ASSERT(EXTERNAL_MEMORY->log_head == 24); // Only the first line is available yet.
+	ASSERT(std::strncmp(EXTERNAL_MEMORY->log_buffer, expected, length) == 0);
+}
+
+TEST_CASE(RLM3_LogBuffer_DebugChar_ReusedChannelBuffer)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+
+	char channel[8] = "aa";
+	RLM3_LogBuffer_DebugChar(channel, 'a');
+	std::strcpy(channel, "bb"); // Same pointer, new channel.
+	RLM3_LogBuffer_DebugChar(channel, 'b');
+	RLM3_LogBuffer_DebugChar("bb", 'c'); // New pointer, same channel.
+	std::strcpy(channel, "c c"); // Cannot be interned.
+	RLM3_LogBuffer_DebugChar(channel, 'd');
+	std::strcpy(channel, "c d");
+	RLM3_LogBuffer_DebugChar(channel, 'e');
+	RLM3_LogBuffer_DebugChar("c d", 'f');
+	RLM3_LogBuffer_DebugChar("c d", '\n');
+
+	const char* expected = "I 0 aa\nd 0 a\nI 1 bb\nd 1 bc\nD c c d\nD c d ef\n";
+	size_t length = std::strlen(expected);
+	ASSERT(EXTERNAL_MEMORY->log_head == length);
 	ASSERT(std::strncmp(EXTERNAL_MEMORY->log_buffer, expected, length) == 0);
 }
 
@@ -380,7 +519,7 @@ TEST_CASE(RLM3_LogBuffer_DebugChar_FollowedWithLog)
 	RLM3_LogBuffer_DebugChar("test-channel", 'b');
 	RLM3_LogBuffer_FormatRawMessage("CD");
 
-	const char* expected = "D test-channel ab\nCD\n";
+	const char* expected = "I 0 test-channel\nd 0 ab\nCD\n";
 	size_t length = std::strlen(expected);
 	ASSERT(EXTERNAL_MEMORY->log_tail == 0);
 	ASSERT(EXTERNAL_MEMORY->log_head == length);
@@ -392,7 +531,7 @@ TEST_CASE(RLM3_LogBuffer_DebugChar_InitialJustFits)
 	RLM3_MEMORY_Init();
 	EXTERNAL_MEMORY->log_magic = 0x4C4F474D;
 	EXTERNAL_MEMORY->log_tail = 0x12345678;
-	EXTERNAL_MEMORY->log_head = 0x12345678 + BUFFER_SIZE - 17;
+	EXTERNAL_MEMORY->log_head = 0x12345678 + BUFFER_SIZE - 23;
 	RLM3_LogBuffer_Init();
 
 	RLM3_LogBuffer_DebugChar("test-channel", 'a');
@@ -406,13 +545,13 @@ TEST_CASE(RLM3_LogBuffer_DebugChar_InitialFull)
 	RLM3_MEMORY_Init();
 	EXTERNAL_MEMORY->log_magic = 0x4C4F474D;
 	EXTERNAL_MEMORY->log_tail = 0x12345678;
-	EXTERNAL_MEMORY->log_head = 0x12345678 + BUFFER_SIZE - 16;
+	EXTERNAL_MEMORY->log_head = 0x12345678 + BUFFER_SIZE - 22;
 	RLM3_LogBuffer_Init();
 
 	RLM3_LogBuffer_DebugChar("test-channel", 'a');
 	RLM3_LogBuffer_DebugChar("test-channel", '\n');
 
-	ASSERT(EXTERNAL_MEMORY->log_head == 0x12345678 + BUFFER_SIZE - 16);
+	ASSERT(EXTERNAL_MEMORY->log_head == 0x12345678 + BUFFER_SIZE - 22);
 }
 
 TEST_CASE(RLM3_LogBuffer_DebugChar_SecondJustFits)
@@ -420,7 +559,7 @@ TEST_CASE(RLM3_LogBuffer_DebugChar_SecondJustFits)
 	RLM3_MEMORY_Init();
 	EXTERNAL_MEMORY->log_magic = 0x4C4F474D;
 	EXTERNAL_MEMORY->log_tail = 0x12345678;
-	EXTERNAL_MEMORY->log_head = 0x12345678 + BUFFER_SIZE - 18;
+	EXTERNAL_MEMORY->log_head = 0x12345678 + BUFFER_SIZE - 24;
 	RLM3_LogBuffer_Init();
 
 	RLM3_LogBuffer_DebugChar("test-channel", 'a');
@@ -435,7 +574,7 @@ TEST_CASE(RLM3_LogBuffer_DebugChar_SecondFull)
 	RLM3_MEMORY_Init();
 	EXTERNAL_MEMORY->log_magic = 0x4C4F474D;
 	EXTERNAL_MEMORY->log_tail = 0x12345678;
-	EXTERNAL_MEMORY->log_head = 0x12345678 + BUFFER_SIZE - 17;
+	EXTERNAL_MEMORY->log_head = 0x12345678 + BUFFER_SIZE - 23;
 	RLM3_LogBuffer_Init();
 
 	RLM3_LogBuffer_DebugChar("test-channel", 'a');
@@ -445,8 +584,569 @@ TEST_CASE(RLM3_LogBuffer_DebugChar_SecondFull)
 	ASSERT(EXTERNAL_MEMORY->log_head == 0x12345678 + BUFFER_SIZE);
 }
 
+static std::string ReadSnapshot()
+{
+	std::string result;
+	const void* data;
+	size_t size;
+	while ((size = RLM3_LogBuffer_GetSnapshotChunk(&data)) != 0)
+		result.append((const char*)data, size);
+	return result;
+}
+
+TEST_CASE(RLM3_LogBuffer_Snapshot_RoundTrip)
+{
+	RLM3_MEMORY_Init();
+	EXTERNAL_MEMORY->log_magic = 0x4C4F474D;
+	EXTERNAL_MEMORY->log_tail = (uint32_t)(0 - 8); // Make the log data wrap the end of the buffer.
+	EXTERNAL_MEMORY->log_head = (uint32_t)(0 - 8);
+	EXTERNAL_MEMORY->fault_magic = 0x12345678;
+	std::strncpy(EXTERNAL_MEMORY->fault_cause, "test-fault-cause", sizeof(EXTERNAL_MEMORY->fault_cause));
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FormatRawMessage("first message");
+	RLM3_LogBuffer_FormatRawMessage("second message");
+
+	RLM3_LogBuffer_BeginSnapshot();
+	ASSERT(RLM3_LogBuffer_IsSnapshotActive());
+	RLM3_LogBuffer_FormatRawMessage("after snapshot"); // Live logging continues but is not part of the snapshot.
+	std::string snapshot = ReadSnapshot();
+	RLM3_LogBuffer_EndSnapshot();
+	ASSERT(!RLM3_LogBuffer_IsSnapshotActive());
+
+	RLM3_LogSnapshotHeader header;
+	ASSERT(snapshot.size() >= sizeof(header));
+	std::memcpy(&header, snapshot.data(), sizeof(header));
+	ASSERT(header.magic == 0x4C534E50);
+	ASSERT(header.version == 2);
+	ASSERT(header.header_size == sizeof(header));
+	ASSERT(header.intern_size == 0);
+	ASSERT(header.buffer_size == BUFFER_SIZE);
+	ASSERT(header.log_magic == 0x4C4F474D);
+	ASSERT(header.log_tail == (uint32_t)(0 - 8));
+	ASSERT(header.log_head == (uint32_t)(0 - 8) + 29);
+	ASSERT(header.fault_magic == 0x12345678);
+	ASSERT(header.total_size == snapshot.size());
+	ASSERT(std::strcmp(snapshot.data() + header.fault_cause_offset, "test-fault-cause") == 0);
+	ASSERT(snapshot.substr(header.data_offset, header.data_size) == "first message\nsecond message\n");
+	ASSERT(EXTERNAL_MEMORY->log_head == header.log_head + 15);
+}
+
+TEST_CASE(RLM3_LogBuffer_Snapshot_ProtectsData)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FormatRawMessage("snapshot data");
+
+	RLM3_LogBuffer_BeginSnapshot();
+	const void* data;
+	ASSERT(RLM3_LogBuffer_GetSnapshotChunk(&data) == sizeof(RLM3_LogSnapshotHeader) + sizeof(EXTERNAL_MEMORY->fault_cause) + sizeof(EXTERNAL_MEMORY->fault_communication_thread_state));
+
+	// The consumer drains the log, but the snapshot still needs the data, so it may not be overwritten.
+	EXTERNAL_MEMORY->log_tail = EXTERNAL_MEMORY->log_head;
+	std::string filler(BUFFER_SIZE - 10, 'x');
+	RLM3_LogBuffer_FormatRawMessage("%s", filler.c_str());
+	ASSERT(EXTERNAL_MEMORY->log_head == 14);
+
+	size_t size = RLM3_LogBuffer_GetSnapshotChunk(&data);
+	ASSERT(size == 14);
+	ASSERT(std::strncmp((const char*)data, "snapshot data\n", size) == 0);
+
+	// Once the chunk is released, the space can be reused.
+	ASSERT(RLM3_LogBuffer_GetSnapshotChunk(&data) == 0);
+	RLM3_LogBuffer_EndSnapshot();
+	EXTERNAL_MEMORY->log_tail = RLM3_LogBuffer_FetchBlock(BUFFER_SIZE);
+	RLM3_LogBuffer_FormatRawMessage("%s", filler.c_str());
+	ASSERT(EXTERNAL_MEMORY->log_head == 14 + BUFFER_SIZE - 9);
+}
+
+TEST_CASE(RLM3_LogBuffer_Snapshot_HoldsChunk)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FormatRawMessage("held chunk");
+	RLM3_LogBuffer_BeginSnapshot();
+	const void* data;
+	RLM3_LogBuffer_GetSnapshotChunk(&data);
+	ASSERT(RLM3_LogBuffer_GetSnapshotChunk(&data) == 11);
+
+	// The chunk is still being sent, so logging enough to wrap the ring must not overwrite it.
+	std::string filler(99, 'x');
+	for (size_t i = 0; i < BUFFER_SIZE / 100; i++)
+	{
+		EXTERNAL_MEMORY->log_tail = RLM3_LogBuffer_FetchBlock(BUFFER_SIZE);
+		RLM3_LogBuffer_FormatRawMessage("%s", filler.c_str());
+	}
+	EXTERNAL_MEMORY->log_tail = RLM3_LogBuffer_FetchBlock(BUFFER_SIZE);
+	RLM3_LogBuffer_FormatRawMessage("%s", filler.substr(0, BUFFER_SIZE % 100 - 1).c_str()); // Would reach the held chunk.
+
+	ASSERT(std::strncmp((const char*)data, "held chunk\n", 11) == 0);
+	RLM3_LogBufferStats stats;
+	RLM3_LogBuffer_GetStats(&stats);
+	ASSERT(stats.dropped_bytes != 0);
+}
+
+TEST_CASE(RLM3_LogBuffer_Snapshot_NotInitialized)
+{
+	ASSERT_ASSERTS(RLM3_LogBuffer_BeginSnapshot());
+}
+
+TEST_CASE(RLM3_LogBuffer_Snapshot_AlreadyActive)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_BeginSnapshot();
+
+	ASSERT_ASSERTS(RLM3_LogBuffer_BeginSnapshot());
+}
+
+TEST_CASE(RLM3_LogBuffer_Snapshot_NotActive)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	const void* data;
+
+	ASSERT_ASSERTS(RLM3_LogBuffer_GetSnapshotChunk(&data));
+	ASSERT_ASSERTS(RLM3_LogBuffer_EndSnapshot());
+}
+
+TEST_CASE(RLM3_LogBuffer_Recorder_FlushedOnError)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+
+	RLM3_Delay(10);
+	RLM3_LogBuffer_Record("DEBUG", "ZONE", "step %d of %u", 1, 2, 0, 0);
+	RLM3_Delay(5);
+	RLM3_LogBuffer_Record("TRACE", "ZONE", "value %04X", 0xBEE, 0, 0, 0);
+	RLM3_LogBuffer_FormatLogMessage("WARN", "ZONE", "not a trigger");
+	ASSERT(RLM3_LogBuffer_GetRecorderCount() == 2);
+
+	RLM3_Delay(5);
+	RLM3_LogBuffer_FormatLogMessage("ERROR", "ZONE", "failed");
+
+	const char* expected =
+		"I 0 WARN\nI 1 ZONE\nl 15 0 1 not a trigger\n"
+		"I 2 DEBUG\nl 10 2 1 step 1 of 2\n"
+		"I 3 TRACE\nl 15 3 1 value 0BEE\n"
+		"I 4 ERROR\nl 20 4 1 failed\n";
+	ASSERT(RLM3_LogBuffer_GetRecorderCount() == 0);
+	ASSERT(EXTERNAL_MEMORY->log_head == std::strlen(expected));
+	ASSERT(std::strncmp(EXTERNAL_MEMORY->log_buffer, expected, std::strlen(expected)) == 0);
+}
+
+TEST_CASE(RLM3_LogBuffer_Recorder_KeepsNewest)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+
+	for (uint32_t i = 0; i < 1000; i++)
+		RLM3_LogBuffer_Record("DEBUG", "ZONE", "%u", i, 0, 0, 0);
+	ASSERT(RLM3_LogBuffer_GetRecorderCount() == 64);
+	RLM3_LogBuffer_FlushRecorder();
+
+	std::string log(EXTERNAL_MEMORY->log_buffer, EXTERNAL_MEMORY->log_head);
+	ASSERT(log.find("I 0 DEBUG\nI 1 ZONE\nl 0 0 1 936\n") == 0);
+	ASSERT(log.find("l 0 0 1 999\n") == log.size() - 12);
+	ASSERT(log.find("935") == std::string::npos);
+}
+
+TEST_CASE(RLM3_LogBuffer_Recorder_UnsupportedFormat)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+
+	// A %s argument may not be valid anymore by the time it is flushed, so the format is logged as is.
+	RLM3_LogBuffer_Record("DEBUG", "ZONE", "name %s", 1234, 0, 0, 0);
+	RLM3_LogBuffer_FlushRecorder();
+
+	const char* expected = "I 0 DEBUG\nI 1 ZONE\nl 0 0 1 name %s\n";
+	ASSERT(EXTERNAL_MEMORY->log_head == std::strlen(expected));
+	ASSERT(std::strncmp(EXTERNAL_MEMORY->log_buffer, expected, std::strlen(expected)) == 0);
+}
+
+TEST_CASE(RLM3_LogBuffer_Recorder_TooManyArguments)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+
+	RLM3_LogBuffer_Record("DEBUG", "ZONE", "%d %d %d %d %d", 1, 2, 3, 4);
+	RLM3_LogBuffer_FlushRecorder();
+
+	const char* expected = "I 0 DEBUG\nI 1 ZONE\nl 0 0 1 %d %d %d %d %d\n";
+	ASSERT(EXTERNAL_MEMORY->log_head == std::strlen(expected));
+	ASSERT(std::strncmp(EXTERNAL_MEMORY->log_buffer, expected, std::strlen(expected)) == 0);
+}
+
+TEST_CASE(RLM3_LogBuffer_Recorder_ErrorFromISR)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+
+	RLM3_LogBuffer_Record("DEBUG", "ZONE", "step %d", 1, 0, 0, 0);
+	RLM3_Delay(5);
+	SIM_DoInterrupt([] {
+		RLM3_LogBuffer_FormatLogMessage("ERROR", "ZONE", "failed");
+	});
+	ASSERT(RLM3_LogBuffer_GetRecorderCount() == 1);
+	RLM3_Delay(5);
+	RLM3_LogBuffer_FetchBlock(0);
+
+	const char* expected =
+		"I 0 ERROR\nI 1 ZONE\nl 5 0 1 failed\n"
+		"I 2 DEBUG\nl 0 2 1 step 1\n";
+	ASSERT(RLM3_LogBuffer_GetRecorderCount() == 0);
+	ASSERT(EXTERNAL_MEMORY->log_head == std::strlen(expected));
+	ASSERT(std::strncmp(EXTERNAL_MEMORY->log_buffer, expected, std::strlen(expected)) == 0);
+}
+
+TEST_CASE(RLM3_LogBuffer_Recorder_FlushedFromFault)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_Record("DEBUG", "ZONE", "step %d", 1, 0, 0, 0);
+
+	SIM_DoInterrupt([] {
+		RLM3_LogBuffer_FlushRecorder();
+		EXTERNAL_MEMORY->fault_magic = 0x464F554C;
+		std::strncpy(EXTERNAL_MEMORY->fault_cause, "test-fault-cause", sizeof(EXTERNAL_MEMORY->fault_cause));
+		std::strncpy(EXTERNAL_MEMORY->fault_communication_thread_state, "comm", sizeof(EXTERNAL_MEMORY->fault_communication_thread_state));
+	});
+	RLM3_LogBuffer_Deinit();
+	RLM3_LogBuffer_Init();
+
+	const char* expected =
+		"I 0 DEBUG\nI 1 ZONE\nl 0 0 1 step 1\n"
+		"I 0 FATAL\nI 1 LOG_BUFFER\nl 0 0 1 Forced Restart: 'test-fault-cause' COMM: comm\n";
+	ASSERT(EXTERNAL_MEMORY->log_head == std::strlen(expected));
+	ASSERT(std::strncmp(EXTERNAL_MEMORY->log_buffer, expected, std::strlen(expected)) == 0);
+}
+
+TEST_CASE(RLM3_LogBuffer_Recorder_BeforeInit)
+{
+	RLM3_MEMORY_Init();
+	SIM_DoInterrupt([] {
+		RLM3_LogBuffer_Record("DEBUG", "ZONE", "early %c", 'x', 0, 0, 0);
+	});
+	RLM3_LogBuffer_FlushRecorder();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FlushRecorder();
+
+	const char* expected = "I 0 DEBUG\nI 1 ZONE\nl 0 0 1 early x\n";
+	ASSERT(EXTERNAL_MEMORY->log_head == std::strlen(expected));
+	ASSERT(std::strncmp(EXTERNAL_MEMORY->log_buffer, expected, std::strlen(expected)) == 0);
+}
+
+TEST_CASE(RLM3_LogBuffer_GetStats)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	std::string filler(BUFFER_SIZE / 2, 'x');
+
+	RLM3_LogBuffer_FormatRawMessage("%s", filler.c_str());
+	RLM3_LogBuffer_DebugChar("ch", 'a');
+	RLM3_LogBuffer_DebugChar("ch", 'b');
+	RLM3_LogBuffer_FormatRawMessage("%s", filler.c_str()); // Does not fit.
+	RLM3_LogBuffer_FormatRawMessage("small"); // Dropped until the buffer drains.
+	RLM3_LogBufferStats stats;
+	RLM3_LogBuffer_GetStats(&stats);
+
+	ASSERT(stats.written_bytes == BUFFER_SIZE / 2 + 1 + 14);
+	ASSERT(stats.dropped_bytes == BUFFER_SIZE / 2 + 1 + 6);
+	ASSERT(stats.overflow_count == 1);
+	ASSERT(stats.peak_used_size == BUFFER_SIZE / 2 + 1 + 14);
+
+	// Logging starts again once the consumer has drained the buffer.
+	EXTERNAL_MEMORY->log_tail = RLM3_LogBuffer_FetchBlock(BUFFER_SIZE);
+	RLM3_LogBuffer_FetchBlock(BUFFER_SIZE);
+	RLM3_LogBuffer_FormatRawMessage("%s", filler.c_str());
+	RLM3_LogBuffer_FormatRawMessage("%s", filler.c_str());
+	RLM3_LogBuffer_GetStats(&stats);
+	ASSERT(stats.overflow_count == 2);
+}
+
+TEST_CASE(RLM3_LogBuffer_Intern_SameName)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	std::string zone = "ZONE"; // Not the same pointer as the literal.
+
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "a");
+	RLM3_LogBuffer_FormatLogMessage("INFO", zone.c_str(), "b");
+	RLM3_LogBuffer_DebugChar("ZONE", 'c');
+	RLM3_LogBuffer_DebugChar("ZONE", '\n');
+
+	const char* expected = "I 0 INFO\nI 1 ZONE\nl 0 0 1 a\nl 0 0 1 b\nd 1 c\n";
+	ASSERT(EXTERNAL_MEMORY->log_head == std::strlen(expected));
+	ASSERT(std::strncmp(EXTERNAL_MEMORY->log_buffer, expected, std::strlen(expected)) == 0);
+	ASSERT(std::strcmp(RLM3_LogBuffer_GetInternName(0), "INFO") == 0);
+	ASSERT(std::strcmp(RLM3_LogBuffer_GetInternName(1), "ZONE") == 0);
+	ASSERT(RLM3_LogBuffer_GetInternName(2) == nullptr);
+}
+
+TEST_CASE(RLM3_LogBuffer_Intern_CopiesName)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	char zone[] = "ZONE";
+
+	RLM3_LogBuffer_FormatLogMessage("INFO", zone, "a");
+	zone[0] = 'X'; // The table keeps its own copy, so the caller's buffer may change.
+	RLM3_LogBuffer_FormatLogMessage("INFO", zone, "b");
+
+	const char* expected = "I 0 INFO\nI 1 ZONE\nl 0 0 1 a\nI 2 XONE\nl 0 0 2 b\n";
+	ASSERT(std::string(EXTERNAL_MEMORY->log_buffer, EXTERNAL_MEMORY->log_head) == expected);
+	ASSERT(std::strcmp(RLM3_LogBuffer_GetInternName(1), "ZONE") == 0);
+	ASSERT(std::strcmp(RLM3_LogBuffer_GetInternName(2), "XONE") == 0);
+}
+
+TEST_CASE(RLM3_LogBuffer_Intern_NotInternable)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	std::string long_name(33, 'z');
+
+	RLM3_LogBuffer_FormatLogMessage("INFO", "two words", "a");
+	RLM3_LogBuffer_FormatLogMessage("INFO", long_name.c_str(), "b");
+	RLM3_LogBuffer_DebugChar("", 'c');
+	RLM3_LogBuffer_DebugChar("", '\n');
+
+	std::string expected = "L 0 INFO two words a\nL 0 INFO " + long_name + " b\nD  c\n";
+	ASSERT(std::string(EXTERNAL_MEMORY->log_buffer, EXTERNAL_MEMORY->log_head) == expected);
+	ASSERT(std::strcmp(RLM3_LogBuffer_GetInternName(0), "INFO") == 0); // Interned, but not used on its own.
+	ASSERT(RLM3_LogBuffer_GetInternName(1) == nullptr);
+}
+
+TEST_CASE(RLM3_LogBuffer_Intern_TableFull)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	std::vector<std::string> zones;
+	for (size_t i = 0; i < 64; i++)
+		zones.push_back("Z" + std::to_string(i));
+
+	for (const std::string& zone : zones)
+		RLM3_LogBuffer_FormatLogMessage(zone.c_str(), zone.c_str(), "x");
+	uint32_t head = EXTERNAL_MEMORY->log_head;
+	RLM3_LogBuffer_FormatLogMessage("Z63", "NEW", "y");
+	RLM3_LogBuffer_FormatLogMessage("Z63", "Z63", "z");
+
+	std::string log(EXTERNAL_MEMORY->log_buffer + head, EXTERNAL_MEMORY->log_head - head);
+	ASSERT(log == "L 0 Z63 NEW y\nl 0 63 63 z\n");
+	ASSERT(std::strcmp(RLM3_LogBuffer_GetInternName(63), "Z63") == 0);
+	ASSERT(RLM3_LogBuffer_GetInternName(64) == nullptr);
+}
+
+TEST_CASE(RLM3_LogBuffer_Intern_Repeat)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "a");
+	RLM3_LogBuffer_RepeatInternTable();
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "b");
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "c");
+
+	const char* expected = "I 0 INFO\nI 1 ZONE\nl 0 0 1 a\nI 0 INFO\nI 1 ZONE\nl 0 0 1 b\nl 0 0 1 c\n";
+	ASSERT(EXTERNAL_MEMORY->log_head == std::strlen(expected));
+	ASSERT(std::strncmp(EXTERNAL_MEMORY->log_buffer, expected, std::strlen(expected)) == 0);
+}
+
+TEST_CASE(RLM3_LogBuffer_Intern_RepeatsOld)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "a");
+	RLM3_LogBuffer_DebugChar("ch", 'x');
+	RLM3_LogBuffer_DebugChar("ch", '\n');
+
+	// Releasing the definitions is not enough, they are still in the ring.
+	EXTERNAL_MEMORY->log_tail = EXTERNAL_MEMORY->log_head;
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "b");
+	ASSERT(std::string(EXTERNAL_MEMORY->log_buffer + EXTERNAL_MEMORY->log_tail, 10) == "l 0 0 1 b\n");
+
+	// Once the log is half the ring past them, they are written again.
+	std::string filler(BUFFER_SIZE / 2, 'x');
+	EXTERNAL_MEMORY->log_tail = EXTERNAL_MEMORY->log_head;
+	RLM3_LogBuffer_FormatRawMessage("%s", filler.c_str());
+	EXTERNAL_MEMORY->log_tail = EXTERNAL_MEMORY->log_head;
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "c");
+	RLM3_LogBuffer_DebugChar("ch", 'y');
+	RLM3_LogBuffer_DebugChar("ch", '\n');
+
+	const char* expected = "I 0 INFO\nI 1 ZONE\nl 0 0 1 c\nI 2 ch\nd 2 y\n";
+	uint32_t tail = EXTERNAL_MEMORY->log_tail;
+	ASSERT(EXTERNAL_MEMORY->log_head - tail == std::strlen(expected));
+	for (size_t i = 0; i < std::strlen(expected); i++)
+		ASSERT(EXTERNAL_MEMORY->log_buffer[(tail + i) % BUFFER_SIZE] == expected[i]);
+}
+
+TEST_CASE(RLM3_LogBuffer_Intern_NewSession)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "a");
+	RLM3_LogBuffer_Deinit();
+	RLM3_LogBuffer_Init();
+
+	// The log survives the restart but the ids are assigned again, so they are defined again.
+	RLM3_LogBuffer_FormatLogMessage("WARN", "ZONE", "b");
+
+	const char* expected = "I 0 INFO\nI 1 ZONE\nl 0 0 1 a\nI 0 WARN\nI 1 ZONE\nl 0 0 1 b\n";
+	ASSERT(EXTERNAL_MEMORY->log_head == std::strlen(expected));
+	ASSERT(std::strncmp(EXTERNAL_MEMORY->log_buffer, expected, std::strlen(expected)) == 0);
+}
+
+TEST_CASE(RLM3_LogBuffer_IsCurrentSession)
+{
+	ASSERT(!RLM3_LogBuffer_IsCurrentSession(0));
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FormatRawMessage("old");
+	RLM3_LogBuffer_Deinit();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FormatRawMessage("new");
+
+	ASSERT(!RLM3_LogBuffer_IsCurrentSession(0));
+	ASSERT(RLM3_LogBuffer_IsCurrentSession(4));
+	EXTERNAL_MEMORY->log_tail = 8;
+	ASSERT(RLM3_LogBuffer_IsCurrentSession(8));
+}
+
+static std::function<void()> g_staging_copied_hook;
+
+extern "C" void SIM_LogBuffer_StagingCopied()
+{
+	if (g_staging_copied_hook)
+		g_staging_copied_hook();
+}
+
+TEST_CASE(RLM3_LogBuffer_Staging_InterruptDuringCopy)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_FormatRawMessage("first");
+
+	// Stands in for an interrupt that stages a record while Init is copying the earlier ones.
+	size_t interrupt_count = 0;
+	g_staging_copied_hook = [&]
+	{
+		if (interrupt_count++ == 0)
+			SIM_DoInterrupt([] { RLM3_LogBuffer_FormatRawMessage("second"); });
+	};
+	RLM3_LogBuffer_Init();
+	g_staging_copied_hook = nullptr;
+	RLM3_LogBuffer_FormatRawMessage("third");
+
+	ASSERT(interrupt_count == 2); // One more pass copies the record staged by the interrupt.
+	ASSERT(std::string(EXTERNAL_MEMORY->log_buffer, EXTERNAL_MEMORY->log_head) == "first\nsecond\nthird\n");
+}
+
+#ifdef RLM3_LOG_BUFFER_PROFILE
+
+static bool g_is_fake_cycle_count = false;
+static uint32_t g_fake_cycle_count = 0;
+static uint32_t g_fake_cycle_step = 0;
+
+extern "C" uint32_t RLM3_LogBuffer_GetCycleCount()
+{
+	if (g_is_fake_cycle_count)
+		return g_fake_cycle_count += g_fake_cycle_step;
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t)(now.tv_sec * 1000000000ull + now.tv_nsec);
+}
+
+// Longest any critical section may take.  The Makefile sets it, and the default leaves room for preemption on a loaded
+// build machine.
+#ifndef RLM3_LOG_BUFFER_BUDGET_NS
+#define RLM3_LOG_BUFFER_BUDGET_NS (250000)
+#endif
+
+TEST_CASE(RLM3_LogBuffer_Profile_Sites)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	g_is_fake_cycle_count = true;
+	g_fake_cycle_step = 100;
+
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "message");
+	RLM3_LogBuffer_DebugChar("ch", 'a');
+	g_fake_cycle_step = 5000;
+	RLM3_LogBuffer_DebugChar("ch", '\n');
+	RLM3_LogBuffer_Profile profile;
+	RLM3_LogBuffer_GetProfile(&profile);
+	g_is_fake_cycle_count = false;
+
+	const RLM3_LogBuffer_ProfileSiteStats& begin = profile.sites[RLM3_LOGBUFFER_SITE_BEGIN_OUTPUT];
+	const RLM3_LogBuffer_ProfileSiteStats& debug_char = profile.sites[RLM3_LOGBUFFER_SITE_DEBUG_CHAR];
+	ASSERT(begin.count == 1 && begin.max == 100 && begin.histogram[6] == 1);
+	ASSERT(profile.sites[RLM3_LOGBUFFER_SITE_END_OUTPUT].count == 1);
+	ASSERT(debug_char.count == 2 && debug_char.total == 5100 && debug_char.max == 5000);
+	ASSERT(debug_char.histogram[6] == 1 && debug_char.histogram[12] == 1);
+	ASSERT(profile.worst == 5000 && profile.worst_site == RLM3_LOGBUFFER_SITE_DEBUG_CHAR);
+	ASSERT(std::strcmp(RLM3_LogBuffer_GetProfileSiteName(profile.worst_site), "DebugChar") == 0);
+
+	RLM3_LogBuffer_ResetProfile();
+	RLM3_LogBuffer_GetProfile(&profile);
+	ASSERT(profile.sites[RLM3_LOGBUFFER_SITE_DEBUG_CHAR].count == 0);
+}
+
+TEST_CASE(RLM3_LogBuffer_Profile_Budget)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+
+	// Go through every critical section with the inputs that make it longest.
+	std::string long_channel(200, 'c');
+	std::string filler(BUFFER_SIZE / 4, 'x');
+	for (size_t i = 0; i < 1000; i++)
+	{
+		RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "message %u", (unsigned)i);
+		SIM_DoInterrupt([&] { RLM3_LogBuffer_DebugChar(long_channel.c_str(), 'a'); });
+		RLM3_LogBuffer_DebugChar("ch", 'b');
+		RLM3_LogBuffer_Record("DEBUG", "ZONE", "recorded %u", (unsigned)i, 0, 0, 0);
+	}
+	RLM3_LogBuffer_FormatLogMessage("ERROR", "ZONE", "flush the recorder");
+	RLM3_LogBuffer_BeginSnapshot();
+	RLM3_LogBuffer_EndSnapshot();
+	RLM3_LogBufferStats stats;
+	RLM3_LogBuffer_GetStats(&stats);
+	for (size_t i = 0; i < 8; i++)
+		RLM3_LogBuffer_FormatRawMessage("%s", filler.c_str()); // Overflow.
+	RLM3_LogBuffer_Profile profile;
+	RLM3_LogBuffer_GetProfile(&profile);
+
+	std::printf("Log buffer critical sections (ns):\n");
+	for (size_t site = 0; site < RLM3_LOGBUFFER_SITE_COUNT; site++)
+	{
+		const RLM3_LogBuffer_ProfileSiteStats& stats = profile.sites[site];
+		std::printf("  %-20s count %6u mean %6.0f max %6u\n", RLM3_LogBuffer_GetProfileSiteName((RLM3_LogBuffer_ProfileSite)site),
+			(unsigned)stats.count, (stats.count != 0) ? (double)stats.total / stats.count : 0.0, (unsigned)stats.max);
+	}
+	std::printf("  worst %u in %s\n", (unsigned)profile.worst, RLM3_LogBuffer_GetProfileSiteName(profile.worst_site));
+
+	// Every section is entered the expected number of times.
+	ASSERT(profile.sites[RLM3_LOGBUFFER_SITE_DEBUG_CHAR].count == 2000);
+	ASSERT(profile.sites[RLM3_LOGBUFFER_SITE_RECORD].count == 1000);
+	ASSERT(profile.sites[RLM3_LOGBUFFER_SITE_FLUSH_RECORDER].count == 64 + 1);
+	ASSERT(profile.sites[RLM3_LOGBUFFER_SITE_BEGIN_SNAPSHOT].count == 1);
+	ASSERT(profile.sites[RLM3_LOGBUFFER_SITE_BEGIN_OUTPUT].count == 1000 + 64 + 1 + 8);
+	ASSERT(profile.sites[RLM3_LOGBUFFER_SITE_END_OUTPUT].count == 1000 + 64 + 1 + 3); // Three fillers fit.
+	for (size_t site = 0; site < RLM3_LOGBUFFER_SITE_COUNT; site++)
+		ASSERT(profile.sites[site].count != 0);
+
+	// None of the sections do work that grows with the log, so every one of them fits in the budget.
+	for (size_t site = 0; site < RLM3_LOGBUFFER_SITE_COUNT; site++)
+		ASSERT(profile.sites[site].max <= RLM3_LOG_BUFFER_BUDGET_NS);
+}
+
+#endif
+
 TEST_TEARDOWN(LOG_BUFFER_TEARDOWN)
 {
+	g_staging_copied_hook = nullptr;
+#ifdef RLM3_LOG_BUFFER_PROFILE
+	g_is_fake_cycle_count = false;
+#endif
 	if (RLM3_LogBuffer_IsInit())
 		RLM3_LogBuffer_Deinit();
 }
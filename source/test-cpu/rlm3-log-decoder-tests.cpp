@@ -0,0 +1,315 @@
+#include "Test.hpp"
+#include "rlm3-log-decoder.hpp"
+#include "rlm3-log-buffer.h"
+#include "rlm3-memory.h"
+#include "rlm3-settings.h"
+#include "rlm3-task.h"
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+static constexpr size_t BUFFER_SIZE = sizeof(ExternalMemoryLayout::log_buffer);
+
+
+static std::vector<std::string> DecodeAll(const LogSource& source)
+{
+	std::vector<std::string> result;
+	source.Decode([&](const LogRecord& record)
+	{
+		if (record.type == LogRecordType::INTERN)
+			return;
+		std::string item(1, (char)record.type);
+		item += "|" + std::to_string(record.time) + "|" + std::string(record.level) + "|" + std::string(record.zone) + "|" + std::string(record.text);
+		result.push_back(item);
+	});
+	return result;
+}
+
+
+TEST_CASE(ParseLogRecord_Log)
+{
+	LogRecord record;
+	ParseLogRecord("L 1234 INFO ZONE hello world\n", 7, &record);
+
+	ASSERT(record.type == LogRecordType::LOG);
+	ASSERT(record.offset == 7);
+	ASSERT(record.size == 29);
+	ASSERT(record.time == 1234);
+	ASSERT(record.level == "INFO");
+	ASSERT(record.zone == "ZONE");
+	ASSERT(record.text == "hello world");
+}
+
+TEST_CASE(ParseLogRecord_Debug)
+{
+	LogRecord record;
+	ParseLogRecord("D gps $GPGGA,1\n", 0, &record);
+
+	ASSERT(record.type == LogRecordType::DEBUG);
+	ASSERT(record.zone == "gps");
+	ASSERT(record.text == "$GPGGA,1");
+}
+
+TEST_CASE(ParseLogRecord_Response)
+{
+	LogRecord record;
+	ParseLogRecord("R 7 pong\n", 0, &record);
+
+	ASSERT(record.type == LogRecordType::RESPONSE);
+	ASSERT(record.zone == "7");
+	ASSERT(record.text == "pong");
+}
+
+TEST_CASE(ParseLogRecord_Interned)
+{
+	LogInternTable table;
+	LogRecord record;
+
+	ParseLogRecord("I 3 WARN\n", 0, &record, &table);
+	ASSERT(record.type == LogRecordType::INTERN);
+	ASSERT(record.zone == "3");
+	ASSERT(record.text == "WARN");
+	ParseLogRecord("I 12 gps\n", 0, &record, &table);
+
+	ParseLogRecord("l 1234 3 7 hello world\n", 0, &record, &table);
+	ASSERT(record.type == LogRecordType::LOG);
+	ASSERT(record.time == 1234);
+	ASSERT(record.level == "WARN");
+	ASSERT(record.zone == "#7"); // Not defined.
+	ASSERT(record.text == "hello world");
+
+	ParseLogRecord("d 12 $GPGGA\n", 0, &record, &table);
+	ASSERT(record.type == LogRecordType::DEBUG);
+	ASSERT(record.zone == "gps");
+	ASSERT(record.text == "$GPGGA");
+
+	// Without a table the ids cannot be resolved.
+	ParseLogRecord("l 1234 3 7 hello world\n", 0, &record);
+	ASSERT(record.type == LogRecordType::RAW);
+	ParseLogRecord("l 1234 x 7 hello world\n", 0, &record, &table);
+	ASSERT(record.type == LogRecordType::RAW);
+}
+
+TEST_CASE(LogInternTable_Redefine)
+{
+	LogInternTable table;
+	table.Define(1, "INFO");
+	std::string_view name = table.Lookup(1);
+
+	table.Define(1, "INFO");
+	ASSERT(table.Lookup(1).data() == name.data()); // Repeated definitions keep earlier names valid.
+	table.Define(1, "WARN");
+	ASSERT(table.Lookup(1) == "WARN");
+	ASSERT(table.Lookup(2) == "#2");
+}
+
+TEST_CASE(ParseLogRecord_Raw)
+{
+	LogRecord record;
+
+	ParseLogRecord("Overflow\n", 0, &record);
+	ASSERT(record.type == LogRecordType::RAW);
+	ASSERT(record.text == "Overflow");
+
+	ParseLogRecord("L abc INFO ZONE text\n", 0, &record);
+	ASSERT(record.type == LogRecordType::RAW);
+
+	ParseLogRecord("L 12 INFO\n", 0, &record);
+	ASSERT(record.type == LogRecordType::RAW);
+}
+
+TEST_CASE(LogSource_Stream)
+{
+	const char* stream = "L 1 INFO A one\nD ch xy\nraw\nL 2 WARN B";
+	LogSource source;
+	ASSERT(source.OpenMemory(stream, std::strlen(stream)));
+
+	std::vector<std::string> records = DecodeAll(source);
+
+	ASSERT(!source.IsMemoryDump());
+	ASSERT(records.size() == 4);
+	ASSERT(records[0] == "L|1|INFO|A|one");
+	ASSERT(records[1] == "D|0||ch|xy");
+	ASSERT(records[2] == "T|0|||raw");
+	ASSERT(records[3] == "L|2|WARN|B|"); // Truncated at the end of the capture.
+}
+
+TEST_CASE(LogSource_MemoryDump)
+{
+	RLM3_MEMORY_Init();
+	EXTERNAL_MEMORY->log_magic = 0x4C4F474D;
+	EXTERNAL_MEMORY->log_tail = (uint32_t)(0 - 10); // Start near the end of the ring so records wrap.
+	EXTERNAL_MEMORY->log_head = (uint32_t)(0 - 10);
+	RLM3_LogBuffer_Init();
+	RLM3_Delay(5);
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "first %d", 1);
+	RLM3_LogBuffer_DebugChar("gps", 'x');
+	RLM3_LogBuffer_DebugChar("gps", '\n');
+	RLM3_LogBuffer_FormatRawMessage("raw");
+
+	LogSource source;
+	ASSERT(source.OpenMemory(EXTERNAL_MEMORY, sizeof(ExternalMemoryLayout)));
+	std::vector<std::string> records = DecodeAll(source);
+
+	ASSERT(source.IsMemoryDump());
+	ASSERT(source.GetSize() == EXTERNAL_MEMORY->log_head - EXTERNAL_MEMORY->log_tail);
+	ASSERT(records.size() == 3);
+	ASSERT(records[0] == "L|5|INFO|ZONE|first 1");
+	ASSERT(records[1] == "D|0||gps|x");
+	ASSERT(records[2] == "T|0|||raw");
+
+	std::string scratch;
+	ASSERT(source.Read(0, 5, scratch) == "I 0 I");
+}
+
+TEST_CASE(LogSource_MemoryDumpInvalid)
+{
+	RLM3_MEMORY_Init();
+	EXTERNAL_MEMORY->log_magic = 0x4C4F474D;
+	EXTERNAL_MEMORY->log_tail = 0;
+	EXTERNAL_MEMORY->log_head = BUFFER_SIZE + 1;
+
+	LogSource source;
+	ASSERT(!source.OpenMemory(EXTERNAL_MEMORY, sizeof(ExternalMemoryLayout)));
+	ASSERT(!source.GetError().empty());
+}
+
+TEST_CASE(LogSource_Snapshot)
+{
+	RLM3_MEMORY_Init();
+	EXTERNAL_MEMORY->fault_magic = 0x464F554C;
+	std::strncpy(EXTERNAL_MEMORY->fault_cause, "test-fault-cause", sizeof(EXTERNAL_MEMORY->fault_cause));
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FormatLogMessage("WARN", "ZONE", "value %d", 3);
+	RLM3_LogBuffer_BeginSnapshot();
+	std::string snapshot;
+	const void* data;
+	size_t size;
+	while ((size = RLM3_LogBuffer_GetSnapshotChunk(&data)) != 0)
+		snapshot.append((const char*)data, size);
+	RLM3_LogBuffer_EndSnapshot();
+
+	LogSource source;
+	ASSERT(source.OpenMemory(snapshot.data(), snapshot.size()));
+	std::vector<std::string> records = DecodeAll(source);
+
+	ASSERT(source.IsSnapshot());
+	ASSERT(source.GetSnapshotFaultCause() == "test-fault-cause");
+	ASSERT(records.size() == 2);
+	ASSERT(records[0].find("L|0|FATAL|LOG_BUFFER|Forced Restart: 'test-fault-cause'") == 0);
+	ASSERT(records[1] == "L|0|WARN|ZONE|value 3");
+}
+
+static std::string ReadSnapshot()
+{
+	std::string result;
+	const void* data;
+	size_t size;
+	RLM3_LogBuffer_BeginSnapshot();
+	while ((size = RLM3_LogBuffer_GetSnapshotChunk(&data)) != 0)
+		result.append((const char*)data, size);
+	RLM3_LogBuffer_EndSnapshot();
+	return result;
+}
+
+TEST_CASE(LogSource_SnapshotTailPastDefinitions)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "first");
+	RLM3_LogBuffer_DebugChar("gps", 'x');
+	RLM3_LogBuffer_DebugChar("gps", '\n');
+	EXTERNAL_MEMORY->log_tail = 18; // Past "I 0 INFO\nI 1 ZONE\n", which the uplink has already sent.
+
+	std::string snapshot = ReadSnapshot();
+	LogSource source;
+	ASSERT(source.OpenMemory(snapshot.data(), snapshot.size()));
+	std::vector<std::string> records = DecodeAll(source);
+
+	ASSERT(source.GetSnapshotHeader().intern_size == std::strlen("I 0 INFO\nI 1 ZONE\nI 2 gps\n"));
+	ASSERT(records.size() == 2);
+	ASSERT(records[0] == "L|0|INFO|ZONE|first");
+	ASSERT(records[1] == "D|0||gps|x");
+}
+
+TEST_CASE(LogSource_SnapshotPreviousSession)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FormatLogMessage("INFO", "OLD", "before");
+	RLM3_LogBuffer_Deinit();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FormatLogMessage("WARN", "NEW", "after");
+
+	// Each session is decoded with its own ids.
+	std::string snapshot = ReadSnapshot();
+	LogSource source;
+	ASSERT(source.OpenMemory(snapshot.data(), snapshot.size()));
+	std::vector<std::string> records = DecodeAll(source);
+
+	ASSERT(records.size() == 2);
+	ASSERT(records[0] == "L|0|INFO|OLD|before");
+	ASSERT(records[1] == "L|0|WARN|NEW|after");
+}
+
+TEST_CASE(LogSource_MemoryDumpTailPastDefinitions)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "first");
+	EXTERNAL_MEMORY->log_tail = EXTERNAL_MEMORY->log_head; // The uplink has sent everything.
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "second");
+
+	LogSource source;
+	ASSERT(source.OpenMemory(EXTERNAL_MEMORY, sizeof(ExternalMemoryLayout)));
+	std::vector<std::string> records = DecodeAll(source);
+
+	ASSERT(records.size() == 1);
+	ASSERT(records[0] == "L|0|INFO|ZONE|second");
+}
+
+TEST_CASE(LogSource_SnapshotVersion1)
+{
+	// Version 1 had no intern table and ended the header at total_size.
+	const char* data = "raw\n";
+	size_t header_size = offsetof(RLM3_LogSnapshotHeader, intern_offset);
+	RLM3_LogSnapshotHeader header = {};
+	header.magic = 0x4C534E50;
+	header.version = 1;
+	header.header_size = (uint16_t)header_size;
+	header.data_offset = (uint32_t)header_size;
+	header.data_size = (uint32_t)std::strlen(data);
+	header.total_size = header.data_offset + header.data_size;
+	std::string snapshot((const char*)&header, header_size);
+	snapshot += data;
+
+	LogSource source;
+	ASSERT(source.OpenMemory(snapshot.data(), snapshot.size()));
+	std::vector<std::string> records = DecodeAll(source);
+
+	ASSERT(source.IsSnapshot());
+	ASSERT(records.size() == 1);
+	ASSERT(records[0] == "T|0|||raw");
+}
+
+TEST_CASE(LogSource_SnapshotTruncated)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FormatRawMessage("data");
+	RLM3_LogBuffer_BeginSnapshot();
+	const void* data;
+	size_t size = RLM3_LogBuffer_GetSnapshotChunk(&data);
+
+	LogSource source;
+	ASSERT(!source.OpenMemory(data, size)); // Only the header, without the log data.
+	ASSERT(!source.GetError().empty());
+}
+
+TEST_CASE(LogSource_OpenMissingFile)
+{
+	LogSource source;
+	ASSERT(!source.Open("/nonexistent/capture.log"));
+	ASSERT(!source.GetError().empty());
+}
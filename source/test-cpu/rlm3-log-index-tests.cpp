@@ -0,0 +1,207 @@
+#include "Test.hpp"
+#include "rlm3-log-index.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+
+static const char* TEST_CAPTURE =
+	"L 10 INFO MOTOR start\n"
+	"L 20 ERROR MOTOR stall\n"
+	"D gps fix\n"
+	"L 15 INFO BATTERY low\n"
+	"L 30 WARN MOTOR hot\n"
+	"raw line\n";
+
+
+static std::string g_index_path;
+static LogSource g_source;
+static LogIndex g_index;
+
+
+static void CreateIndexPath()
+{
+	char path[] = "/tmp/rlm3-log-index-XXXXXX";
+	int fd = ::mkstemp(path);
+	ASSERT(fd >= 0);
+	::close(fd);
+	g_index_path = path;
+}
+
+static void OpenTestIndex()
+{
+	CreateIndexPath();
+	ASSERT(g_source.OpenMemory(TEST_CAPTURE, std::strlen(TEST_CAPTURE)));
+	std::string error;
+	ASSERT(WriteLogIndex(g_source, g_index_path.c_str(), &error));
+	ASSERT(g_index.Open(g_index_path.c_str(), g_source));
+}
+
+static std::string ReadFile(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	std::ostringstream result;
+	result << file.rdbuf();
+	return result.str();
+}
+
+static std::vector<std::string> RunQuery(const LogQuery& query)
+{
+	std::vector<std::string> result;
+	std::string scratch;
+	g_index.Query(query, [&](const LogIndexEntry& entry) { result.emplace_back(g_source.Read(entry.offset, entry.size, scratch)); });
+	return result;
+}
+
+
+TEST_CASE(LogIndex_QueryAll)
+{
+	OpenTestIndex();
+
+	std::vector<std::string> records = RunQuery(LogQuery());
+
+	ASSERT(g_index.GetEntryCount() == 6);
+	ASSERT(records.size() == 6);
+	ASSERT(records[2] == "D gps fix\n");
+	ASSERT(records[5] == "raw line\n");
+}
+
+TEST_CASE(LogIndex_QueryLevelAndZone)
+{
+	OpenTestIndex();
+
+	LogQuery query;
+	query.zone = "MOTOR";
+	ASSERT(RunQuery(query).size() == 3);
+	query.level = "ERROR";
+	ASSERT(RunQuery(query) == std::vector<std::string>({ "L 20 ERROR MOTOR stall\n" }));
+	query.zone = "UNKNOWN";
+	ASSERT(RunQuery(query).empty());
+	query.zone = "gps"; // Debug channels are indexed as zones.
+	query.level.clear();
+	ASSERT(RunQuery(query) == std::vector<std::string>({ "D gps fix\n" }));
+}
+
+TEST_CASE(LogIndex_QueryTimeRange)
+{
+	OpenTestIndex();
+
+	LogQuery query;
+	query.has_time_range = true;
+	query.time_from = 15;
+	query.time_to = 20;
+
+	// Matches are reported in stream order even though the times are not.
+	ASSERT(RunQuery(query) == std::vector<std::string>({ "L 20 ERROR MOTOR stall\n", "L 15 INFO BATTERY low\n" }));
+}
+
+TEST_CASE(LogIndex_QueryLevelAndTimeRange)
+{
+	OpenTestIndex();
+
+	LogQuery query;
+	query.has_time_range = true;
+	query.time_from = 10;
+	query.time_to = 30;
+	query.level = "INFO";
+	ASSERT(RunQuery(query) == std::vector<std::string>({ "L 10 INFO MOTOR start\n", "L 15 INFO BATTERY low\n" }));
+	query.time_from = 12;
+	ASSERT(RunQuery(query) == std::vector<std::string>({ "L 15 INFO BATTERY low\n" }));
+}
+
+TEST_CASE(LogIndex_QueryType)
+{
+	OpenTestIndex();
+
+	LogQuery query;
+	query.type = 'D';
+
+	ASSERT(RunQuery(query) == std::vector<std::string>({ "D gps fix\n" }));
+}
+
+TEST_CASE(LogIndex_SmallRuns)
+{
+	// Sorting in runs of a few items spills them to temporary files and merges them, and gives the same index.
+	OpenTestIndex();
+	std::string expected = ReadFile(g_index_path);
+	g_index.Close();
+	std::string error;
+	ASSERT(WriteLogIndex(g_source, g_index_path.c_str(), &error, 2));
+	ASSERT(ReadFile(g_index_path) == expected);
+
+	ASSERT(g_index.Open(g_index_path.c_str(), g_source));
+	LogQuery query;
+	query.has_time_range = true;
+	query.time_from = 15;
+	query.time_to = 30;
+	query.zone = "MOTOR";
+	ASSERT(RunQuery(query) == std::vector<std::string>({ "L 20 ERROR MOTOR stall\n", "L 30 WARN MOTOR hot\n" }));
+}
+
+TEST_CASE(LogIndex_SmallRuns_Many)
+{
+	std::string capture;
+	for (size_t i = 0; i < 1000; i++)
+		capture += "L " + std::to_string((i * 7919) % 500) + (i % 3 == 0 ? " ERROR" : " INFO") + " ZONE" + std::to_string(i % 5) + " text\n";
+	CreateIndexPath();
+	ASSERT(g_source.OpenMemory(capture.data(), capture.size()));
+	std::string error;
+	ASSERT(WriteLogIndex(g_source, g_index_path.c_str(), &error));
+	std::string expected = ReadFile(g_index_path);
+	ASSERT(WriteLogIndex(g_source, g_index_path.c_str(), &error, 64));
+	ASSERT(ReadFile(g_index_path) == expected);
+}
+
+TEST_CASE(LogIndex_WrongCapture)
+{
+	OpenTestIndex();
+
+	LogSource other;
+	ASSERT(other.OpenMemory(TEST_CAPTURE, 10));
+	LogIndex index;
+	ASSERT(!index.Open(g_index_path.c_str(), other));
+	ASSERT(!index.GetError().empty());
+}
+
+TEST_CASE(LogIndex_NotAnIndex)
+{
+	CreateIndexPath();
+	FILE* file = std::fopen(g_index_path.c_str(), "wb");
+	std::fputs("this is not an index file, but it is long enough to have a header and then some more", file);
+	std::fclose(file);
+
+	ASSERT(g_source.OpenMemory(TEST_CAPTURE, std::strlen(TEST_CAPTURE)));
+	ASSERT(!g_index.Open(g_index_path.c_str(), g_source));
+}
+
+TEST_CASE(LogIndex_EntryCountOverflow)
+{
+	OpenTestIndex();
+	g_index.Close();
+
+	// An entry count whose size wraps around to match the time order offset must still be rejected.
+	LogIndexHeader header;
+	FILE* file = std::fopen(g_index_path.c_str(), "r+b");
+	ASSERT(std::fread(&header, sizeof(header), 1, file) == 1);
+	header.entry_count += 1ull << 61; // Times 24 is a multiple of 2^64.
+	std::fseek(file, 0, SEEK_SET);
+	std::fwrite(&header, sizeof(header), 1, file);
+	std::fclose(file);
+
+	ASSERT(!g_index.Open(g_index_path.c_str(), g_source));
+	ASSERT(!g_index.GetError().empty());
+}
+
+TEST_TEARDOWN(LOG_INDEX_TEARDOWN)
+{
+	g_index.Close();
+	g_source.Close();
+	if (!g_index_path.empty())
+		::unlink(g_index_path.c_str());
+	g_index_path.clear();
+}
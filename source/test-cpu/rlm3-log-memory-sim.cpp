@@ -0,0 +1,42 @@
+#include "rlm3-log-memory-sim.hpp"
+#include "rlm3-settings.h"
+#include "Assert.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+static ExternalMemoryLayout* g_mapped_memory = nullptr;
+
+
+extern bool SIM_LogMemory_MapFile(const char* path)
+{
+	ASSERT(!RLM3_LogBuffer_IsInit());
+	ASSERT(g_mapped_memory == nullptr);
+
+	int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return false;
+	void* memory = MAP_FAILED;
+	if (::ftruncate(fd, sizeof(ExternalMemoryLayout)) == 0)
+		memory = ::mmap(nullptr, sizeof(ExternalMemoryLayout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (memory == MAP_FAILED)
+		return false;
+	g_mapped_memory = (ExternalMemoryLayout*)memory;
+	return true;
+}
+
+extern void SIM_LogMemory_UnmapFile()
+{
+	ASSERT(!RLM3_LogBuffer_IsInit());
+	if (g_mapped_memory != nullptr)
+		::munmap(g_mapped_memory, sizeof(ExternalMemoryLayout));
+	g_mapped_memory = nullptr;
+}
+
+extern ExternalMemoryLayout* SIM_LogMemory()
+{
+	// Replaces the default in the log buffer, which always uses EXTERNAL_MEMORY.
+	return (g_mapped_memory != nullptr) ? g_mapped_memory : EXTERNAL_MEMORY;
+}
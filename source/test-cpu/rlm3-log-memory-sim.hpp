@@ -0,0 +1,10 @@
+#pragma once
+
+#include "rlm3-log-buffer.h"
+
+
+// Moves the simulated log memory into a shared mapping of a file, so another process can follow the log while a
+// simulation runs (rlm3-log-tool tail).  The file is created with the size of ExternalMemoryLayout and keeps its
+// contents between runs like the real external memory.  Only map or unmap while the log buffer is not initialized.
+extern bool SIM_LogMemory_MapFile(const char* path);
+extern void SIM_LogMemory_UnmapFile();
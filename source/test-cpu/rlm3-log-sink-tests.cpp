@@ -0,0 +1,301 @@
+#include "Test.hpp"
+#include "rlm3-log-sink.h"
+#include "rlm3-log-buffer.h"
+#include "rlm3-memory.h"
+#include "rlm3-settings.h"
+#include "rlm3-task.h"
+#include <string>
+
+
+static constexpr RLM3_LogSink_Filter PASS_ALL = { RLM3_LOGSINK_LEVEL_TRACE, nullptr, 0, false, 0, 0 };
+
+
+static std::string ReadAll(RLM3_LogSink* sink)
+{
+	std::string result;
+	const char* data;
+	size_t size;
+	while ((size = RLM3_LogSink_Peek(sink, &data)) != 0)
+	{
+		result.append(data, size);
+		RLM3_LogSink_Consume(sink, size);
+	}
+	return result;
+}
+
+static void InitAfterNames(RLM3_LogSink* sink, const RLM3_LogSink_Filter* filter, const char* level, const char* zone)
+{
+	// Writes the intern definitions ahead of the test and starts the sink after them, so later records are written
+	// without them.  Moving log_tail past them instead would have them written again.
+	RLM3_LogBuffer_FormatLogMessage(level, zone, " ");
+	RLM3_LogSink_Init(sink, filter);
+	sink->cursor = sink->record_end = sink->scan_position = EXTERNAL_MEMORY->log_head;
+}
+
+
+TEST_CASE(RLM3_LogSink_Init_NotInitialized)
+{
+	RLM3_LogSink sink;
+	ASSERT_ASSERTS(RLM3_LogSink_Init(&sink, &PASS_ALL));
+}
+
+TEST_CASE(RLM3_LogSink_PassAll)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogSink sink;
+	RLM3_LogSink_Init(&sink, &PASS_ALL);
+
+	RLM3_LogBuffer_FormatLogMessage("DEBUG", "ZONE", "one");
+	RLM3_LogBuffer_FormatRawMessage("R 1 two");
+
+	ASSERT(!RLM3_LogSink_IsCaughtUp(&sink));
+	ASSERT(ReadAll(&sink) == "I 0 DEBUG\nI 1 ZONE\nl 0 0 1 one\nR 1 two\n");
+	ASSERT(RLM3_LogSink_IsCaughtUp(&sink));
+	ASSERT(EXTERNAL_MEMORY->log_tail == 0); // Sinks do not release data.
+}
+
+TEST_CASE(RLM3_LogSink_LevelFilter)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogSink_Filter filter = PASS_ALL;
+	filter.level = RLM3_LOGSINK_LEVEL_WARN;
+	RLM3_LogSink sink;
+	RLM3_LogSink_Init(&sink, &filter);
+
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "info");
+	RLM3_LogBuffer_FormatLogMessage("WARN", "ZONE", "warn");
+	RLM3_LogBuffer_FormatLogMessage("DEBUG", "ZONE", "debug");
+	RLM3_LogBuffer_FormatLogMessage("FATAL", "ZONE", "fatal");
+	RLM3_LogBuffer_FormatLogMessage("CUSTOM", "ZONE", "custom");
+	RLM3_LogBuffer_FormatLogMessage("WARNING", "ZONE", "warning");
+
+	// Definitions are always sent, even for records that are skipped.
+	ASSERT(ReadAll(&sink) ==
+		"I 0 INFO\nI 1 ZONE\nI 2 WARN\nl 0 2 1 warn\nI 3 DEBUG\nI 4 FATAL\nl 0 4 1 fatal\n"
+		"I 5 CUSTOM\nl 0 5 1 custom\nI 6 WARNING\nl 0 6 1 warning\n");
+	ASSERT(sink.skipped_records == 2);
+	ASSERT(RLM3_LogSink_IsCaughtUp(&sink));
+}
+
+TEST_CASE(RLM3_LogSink_ZoneFilter)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	static const char* const ZONES[] = { "GPS", "MOTOR" };
+	RLM3_LogSink_Filter filter = PASS_ALL;
+	filter.zones = ZONES;
+	filter.zone_count = 2;
+	RLM3_LogSink sink;
+	RLM3_LogSink_Init(&sink, &filter);
+
+	RLM3_LogBuffer_FormatLogMessage("INFO", "GPS", "a");
+	RLM3_LogBuffer_FormatLogMessage("INFO", "GPSX", "b");
+	RLM3_LogBuffer_FormatLogMessage("INFO", "MOTOR", "c");
+	RLM3_LogBuffer_FormatLogMessage("INFO", "WIFI", "d");
+
+	ASSERT(ReadAll(&sink) == "I 0 INFO\nI 1 GPS\nl 0 0 1 a\nI 2 GPSX\nI 3 MOTOR\nl 0 0 3 c\nI 4 WIFI\n");
+}
+
+TEST_CASE(RLM3_LogSink_SkipOther)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogSink_Filter filter = PASS_ALL;
+	filter.is_other_skipped = true;
+	RLM3_LogSink sink;
+	RLM3_LogSink_Init(&sink, &filter);
+
+	RLM3_LogBuffer_DebugChar("gps", 'x');
+	RLM3_LogBuffer_DebugChar("gps", '\n');
+	RLM3_LogBuffer_FormatRawMessage("R 1 pong");
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "kept");
+	RLM3_LogBuffer_FormatLogMessage("NAME WITH SPACES", "ZONE", "kept");
+
+	ASSERT(ReadAll(&sink) == "I 0 gps\nI 1 INFO\nI 2 ZONE\nl 0 1 2 kept\nL 0 NAME WITH SPACES ZONE kept\n");
+}
+
+TEST_CASE(RLM3_LogSink_Rate)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogSink_Filter filter = PASS_ALL;
+	filter.rate = 1000;
+	filter.burst = 30;
+	RLM3_LogSink sink;
+	InitAfterNames(&sink, &filter, "INFO", "ZONE");
+
+	for (size_t i = 0; i < 4; i++)
+		RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "twenty bytes"); // "l 0 0 1 twenty bytes\n" is 21 bytes.
+
+	// The burst covers one record, and then the sink has to wait for the bucket to refill.
+	ASSERT(ReadAll(&sink).size() == 21);
+	ASSERT(RLM3_LogSink_GetRateLimitWait(&sink) == 12);
+	RLM3_Delay(11);
+	ASSERT(ReadAll(&sink).size() == 0);
+	ASSERT(RLM3_LogSink_GetRateLimitWait(&sink) == 1);
+	RLM3_Delay(1);
+	ASSERT(ReadAll(&sink).size() == 21);
+	RLM3_Delay(1000);
+	ASSERT(ReadAll(&sink).size() == 21);
+	ASSERT(!RLM3_LogSink_IsCaughtUp(&sink));
+	ASSERT(RLM3_LogSink_GetRateLimitWait(&sink) == 12);
+	RLM3_Delay(12);
+	ASSERT(ReadAll(&sink).size() == 21);
+	ASSERT(RLM3_LogSink_GetRateLimitWait(&sink) == 0);
+}
+
+TEST_CASE(RLM3_LogSink_IndependentCursors)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogSink_Filter console_filter = PASS_ALL;
+	console_filter.level = RLM3_LOGSINK_LEVEL_WARN;
+	RLM3_LogSink console;
+	RLM3_LogSink network;
+	RLM3_LogSink_Init(&console, &console_filter);
+	RLM3_LogSink_Init(&network, &PASS_ALL);
+
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "one");
+	ASSERT(ReadAll(&console) == "I 0 INFO\nI 1 ZONE\n");
+	RLM3_LogBuffer_FormatLogMessage("ERROR", "ZONE", "two");
+
+	ASSERT(ReadAll(&network) == "I 0 INFO\nI 1 ZONE\nl 0 0 1 one\nI 2 ERROR\nl 0 2 1 two\n");
+	ASSERT(ReadAll(&console) == "I 2 ERROR\nl 0 2 1 two\n");
+}
+
+TEST_CASE(RLM3_LogSink_PartialConsume)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogSink_Filter filter = PASS_ALL;
+	filter.level = RLM3_LOGSINK_LEVEL_INFO;
+	RLM3_LogSink sink;
+	InitAfterNames(&sink, &filter, "INFO", "ZONE");
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "abc");
+	const char* data;
+
+	ASSERT(RLM3_LogSink_Peek(&sink, &data) == 12);
+	RLM3_LogSink_Consume(&sink, 5);
+	ASSERT(RLM3_LogSink_Peek(&sink, &data) == 7);
+	ASSERT(std::string(data, 7) == " 1 abc\n");
+	ASSERT_ASSERTS(RLM3_LogSink_Consume(&sink, 8));
+}
+
+TEST_CASE(RLM3_LogSink_Wraps)
+{
+	RLM3_MEMORY_Init();
+	EXTERNAL_MEMORY->log_magic = 0x4C4F474D;
+	EXTERNAL_MEMORY->log_tail = (uint32_t)(0 - 38);
+	EXTERNAL_MEMORY->log_head = (uint32_t)(0 - 38);
+	RLM3_LogBuffer_Init();
+	RLM3_LogSink_Filter filter = PASS_ALL;
+	filter.level = RLM3_LOGSINK_LEVEL_INFO;
+	RLM3_LogSink sink;
+	InitAfterNames(&sink, &filter, "INFO", "ZONE"); // 28 bytes.
+
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "wrapped message");
+	const char* data;
+
+	ASSERT(RLM3_LogSink_Peek(&sink, &data) == 10);
+	RLM3_LogSink_Consume(&sink, 10);
+	ASSERT(RLM3_LogSink_Peek(&sink, &data) == 14);
+	RLM3_LogSink_Consume(&sink, 14);
+	ASSERT(RLM3_LogSink_IsCaughtUp(&sink));
+}
+
+TEST_CASE(RLM3_LogSink_LongRecord)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogSink_Filter filter = PASS_ALL;
+	filter.level = RLM3_LOGSINK_LEVEL_INFO;
+	RLM3_LogSink sink;
+	InitAfterNames(&sink, &filter, "INFO", "ZONE");
+	std::string text(2000, 'x');
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "%s", text.c_str());
+	const char* data;
+
+	// Finding the end of a long record is spread over several calls.
+	size_t calls = 1;
+	while (RLM3_LogSink_Peek(&sink, &data) == 0)
+		calls++;
+	ASSERT(calls == 4);
+	ASSERT(ReadAll(&sink).size() == 2009);
+}
+
+TEST_CASE(RLM3_LogSink_FallsBehind)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogSink sink;
+	RLM3_LogSink_Init(&sink, &PASS_ALL);
+
+	RLM3_LogBuffer_FormatRawMessage("lost");
+	EXTERNAL_MEMORY->log_tail = EXTERNAL_MEMORY->log_head;
+	RLM3_LogBuffer_FormatRawMessage("kept");
+
+	ASSERT(ReadAll(&sink) == "kept\n");
+	ASSERT(sink.lost_bytes == 5);
+}
+
+TEST_CASE(RLM3_LogSink_PreviousSession)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FormatLogMessage("INFO", "GPS", "old");
+	RLM3_LogBuffer_Deinit();
+	RLM3_LogBuffer_Init();
+	static const char* const ZONES[] = { "MOTOR" };
+	RLM3_LogSink_Filter filter = PASS_ALL;
+	filter.zones = ZONES;
+	filter.zone_count = 1;
+	RLM3_LogSink sink;
+	RLM3_LogSink_Init(&sink, &filter);
+
+	// The ids of the old record mean GPS in its own session but MOTOR in this one.
+	RLM3_LogBuffer_FormatLogMessage("ERROR", "MOTOR", "new");
+
+	ASSERT(ReadAll(&sink) == "I 0 INFO\nI 1 GPS\nI 0 ERROR\nI 1 MOTOR\nl 0 0 1 new\n");
+}
+
+TEST_CASE(RLM3_LogSink_Expanded)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogSink sink;
+	RLM3_LogSink_Init(&sink, &PASS_ALL);
+	RLM3_LogSink_SetExpanded(&sink, true);
+
+	RLM3_LogBuffer_FormatLogMessage("INFO", "ZONE", "one");
+	RLM3_LogBuffer_DebugChar("gps", 'x');
+	RLM3_LogBuffer_DebugChar("gps", '\n');
+	RLM3_LogBuffer_FormatLogMessage("NAME WITH SPACES", "ZONE", "two");
+	RLM3_LogBuffer_FormatRawMessage("R 1 three");
+
+	ASSERT(ReadAll(&sink) == "L 0 INFO ZONE one\nD gps x\nL 0 NAME WITH SPACES ZONE two\nR 1 three\n");
+}
+
+TEST_CASE(RLM3_LogSink_Expanded_PreviousSession)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FormatLogMessage("INFO", "GPS", "old");
+	RLM3_LogBuffer_Deinit();
+	RLM3_LogBuffer_Init();
+	RLM3_LogSink sink;
+	RLM3_LogSink_Init(&sink, &PASS_ALL);
+	RLM3_LogSink_SetExpanded(&sink, true);
+
+	RLM3_LogBuffer_FormatLogMessage("ERROR", "MOTOR", "new");
+
+	// Records from before the restart are sent as they are rather than expanded with the wrong names.
+	ASSERT(ReadAll(&sink) == "l 0 0 1 old\nL 0 ERROR MOTOR new\n");
+}
+
+TEST_TEARDOWN(LOG_SINK_TEARDOWN)
+{
+	if (RLM3_LogBuffer_IsInit())
+		RLM3_LogBuffer_Deinit();
+}
@@ -0,0 +1,275 @@
+#include "Test.hpp"
+#include "rlm3-log-tail.hpp"
+#include "rlm3-log-decoder.hpp"
+#include "rlm3-log-buffer.h"
+#include "rlm3-log-memory-sim.hpp"
+#include "rlm3-memory.h"
+#include "rlm3-settings.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sched.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+static constexpr size_t BUFFER_SIZE = sizeof(ExternalMemoryLayout::log_buffer);
+static constexpr size_t DEFAULT_SOAK_RECORD_COUNT = 100000;
+static constexpr std::chrono::seconds SOAK_TIMEOUT(60);
+
+struct SoakResult
+{
+	uint64_t record_count;
+	uint64_t error_count;
+	uint64_t read_bytes;
+	uint64_t lost_bytes;
+};
+
+
+static std::string GetMemoryFilePath()
+{
+	return "/tmp/rlm3-log-tail-test-" + std::to_string(::getpid());
+}
+
+static std::string MapMemoryFile()
+{
+	std::string path = GetMemoryFilePath();
+	::unlink(path.c_str());
+	ASSERT(SIM_LogMemory_MapFile(path.c_str()));
+	return path;
+}
+
+static std::vector<std::string> PollAll(LogTail& tail)
+{
+	std::vector<std::string> result;
+	tail.Poll([&](std::string_view line) { result.emplace_back(line); });
+	return result;
+}
+
+static SoakResult RunSoakReader(const char* path, size_t record_count)
+{
+	// Runs in the child process, so failures are reported in the result rather than asserted.
+	SoakResult result = {};
+	LogTail tail;
+	if (!tail.Open(path, true))
+	{
+		result.error_count++;
+		return result;
+	}
+	LogInternTable table;
+	auto deadline = std::chrono::steady_clock::now() + SOAK_TIMEOUT;
+	while (result.record_count < record_count && std::chrono::steady_clock::now() < deadline)
+	{
+		result.read_bytes += tail.Poll([&](std::string_view line)
+		{
+			LogRecord record;
+			ParseLogRecord(line, result.read_bytes, &record, &table);
+			if (record.type == LogRecordType::INTERN)
+				return;
+			std::string expected = "record " + std::to_string(result.record_count) + " ";
+			if (record.type != LogRecordType::LOG || record.zone != "SOAK" || record.text.substr(0, expected.size()) != expected)
+				result.error_count++;
+			result.record_count++;
+		});
+	}
+	result.lost_bytes = tail.GetLostBytes();
+	return result;
+}
+
+
+TEST_CASE(SIM_LogMemory_Default)
+{
+	ASSERT(SIM_LogMemory() == EXTERNAL_MEMORY);
+}
+
+TEST_CASE(SIM_LogMemory_MapFile)
+{
+	std::string path = MapMemoryFile();
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+
+	RLM3_LogBuffer_FormatRawMessage("hello");
+
+	ASSERT(SIM_LogMemory() != EXTERNAL_MEMORY);
+	ASSERT(EXTERNAL_MEMORY->log_head == 0);
+	LogSource source;
+	ASSERT(source.Open(path.c_str()));
+	ASSERT(source.IsMemoryDump());
+	std::string scratch;
+	ASSERT(source.Read(0, source.GetSize(), scratch) == "hello\n");
+}
+
+TEST_CASE(SIM_LogMemory_MapFile_KeepsLog)
+{
+	std::string path = MapMemoryFile();
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FormatRawMessage("first run");
+	RLM3_LogBuffer_Deinit();
+	SIM_LogMemory_UnmapFile();
+
+	ASSERT(SIM_LogMemory_MapFile(path.c_str()));
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FormatRawMessage("second run");
+
+	LogSource source;
+	ASSERT(source.Open(path.c_str()));
+	std::string scratch;
+	ASSERT(source.Read(0, source.GetSize(), scratch) == "first run\nsecond run\n");
+}
+
+TEST_CASE(SIM_LogMemory_MapFile_Initialized)
+{
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+
+	ASSERT_ASSERTS(SIM_LogMemory_MapFile(GetMemoryFilePath().c_str()));
+	ASSERT_ASSERTS(SIM_LogMemory_UnmapFile());
+}
+
+TEST_CASE(SIM_LogMemory_MapFile_BadPath)
+{
+	ASSERT(!SIM_LogMemory_MapFile("/nonexistent-directory/log-memory"));
+	ASSERT(SIM_LogMemory() == EXTERNAL_MEMORY);
+}
+
+TEST_CASE(LogTail_Open_NotMemoryFile)
+{
+	std::string path = GetMemoryFilePath();
+	std::FILE* file = std::fopen(path.c_str(), "w");
+	std::fputs("L 1 INFO ZONE text\n", file);
+	std::fclose(file);
+
+	LogTail tail;
+	ASSERT(!tail.Open(path.c_str(), false));
+	ASSERT(!tail.GetError().empty());
+}
+
+TEST_CASE(LogTail_Poll)
+{
+	std::string path = MapMemoryFile();
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	RLM3_LogBuffer_FormatRawMessage("one");
+	LogTail tail;
+	ASSERT(tail.Open(path.c_str(), false));
+
+	RLM3_LogBuffer_FormatRawMessage("two");
+	ASSERT(PollAll(tail) == std::vector<std::string>({ "one\n", "two\n" }));
+	ASSERT(PollAll(tail).empty());
+	RLM3_LogBuffer_FormatRawMessage("three");
+	ASSERT(PollAll(tail) == std::vector<std::string>({ "three\n" }));
+	ASSERT(SIM_LogMemory()->log_tail == 0);
+	ASSERT(tail.GetLostBytes() == 0);
+}
+
+TEST_CASE(LogTail_Poll_Consuming)
+{
+	std::string path = MapMemoryFile();
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	LogTail tail;
+	ASSERT(tail.Open(path.c_str(), true));
+
+	RLM3_LogBuffer_FormatRawMessage("one");
+	RLM3_LogBuffer_FormatRawMessage("two");
+
+	ASSERT(tail.Poll([](std::string_view) {}) == 8);
+	ASSERT(SIM_LogMemory()->log_tail == 8);
+	ASSERT(SIM_LogMemory()->log_head == 8);
+}
+
+TEST_CASE(LogTail_Poll_Wraps)
+{
+	std::string path = MapMemoryFile();
+	RLM3_MEMORY_Init();
+	SIM_LogMemory()->log_magic = 0x4C4F474D;
+	SIM_LogMemory()->log_tail = (uint32_t)(0 - 5);
+	SIM_LogMemory()->log_head = (uint32_t)(0 - 5);
+	RLM3_LogBuffer_Init();
+	LogTail tail;
+	ASSERT(tail.Open(path.c_str(), true));
+
+	RLM3_LogBuffer_FormatRawMessage("abc");
+	RLM3_LogBuffer_FormatRawMessage("wrapped");
+	RLM3_LogBuffer_FormatRawMessage("after");
+
+	ASSERT(PollAll(tail) == std::vector<std::string>({ "abc\n", "wrapped\n", "after\n" }));
+	ASSERT(SIM_LogMemory()->log_tail == 13);
+}
+
+TEST_CASE(LogTail_Poll_Lost)
+{
+	std::string path = MapMemoryFile();
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+	LogTail tail;
+	ASSERT(tail.Open(path.c_str(), false));
+
+	RLM3_LogBuffer_FormatRawMessage("one");
+	RLM3_LogBuffer_FormatRawMessage("two");
+	SIM_LogMemory()->log_tail = 4; // Another consumer released "one" before the tail read it.
+
+	ASSERT(PollAll(tail) == std::vector<std::string>({ "two\n" }));
+	ASSERT(tail.GetLostBytes() == 4);
+}
+
+TEST_CASE(LogTail_Soak)
+{
+	// A consuming tail in another process keeps up with the log buffer.  Set RLM3_SOAK_RECORDS for a longer run.
+	size_t record_count = DEFAULT_SOAK_RECORD_COUNT;
+	if (const char* value = std::getenv("RLM3_SOAK_RECORDS"))
+		record_count = std::strtoul(value, nullptr, 0);
+	std::string path = MapMemoryFile();
+	RLM3_MEMORY_Init();
+	RLM3_LogBuffer_Init();
+
+	int result_pipe[2];
+	ASSERT(::pipe(result_pipe) == 0);
+	pid_t child = ::fork();
+	ASSERT(child >= 0);
+	if (child == 0)
+	{
+		::close(result_pipe[0]);
+		SoakResult result = RunSoakReader(path.c_str(), record_count);
+		ssize_t size = ::write(result_pipe[1], &result, sizeof(result));
+		::_exit(size == sizeof(result) ? 0 : 1);
+	}
+	::close(result_pipe[1]);
+
+	// Hold the producer back while the ring is half full so nothing is dropped.
+	ExternalMemoryLayout* memory = SIM_LogMemory();
+	auto deadline = std::chrono::steady_clock::now() + SOAK_TIMEOUT;
+	for (size_t i = 0; i < record_count; i++)
+	{
+		while (memory->log_head - __atomic_load_n(&memory->log_tail, __ATOMIC_ACQUIRE) > BUFFER_SIZE / 2 && std::chrono::steady_clock::now() < deadline)
+			::sched_yield();
+		RLM3_LogBuffer_FormatLogMessage("INFO", "SOAK", "record %u speed %d rpm", (unsigned)i, (int)(i % 3000));
+	}
+
+	SoakResult result = {};
+	ssize_t size = ::read(result_pipe[0], &result, sizeof(result));
+	::close(result_pipe[0]);
+	int status = 0;
+	::waitpid(child, &status, 0);
+	RLM3_LogBufferStats stats;
+	RLM3_LogBuffer_GetStats(&stats);
+
+	ASSERT(size == sizeof(result));
+	ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	ASSERT(result.record_count == record_count);
+	ASSERT(result.error_count == 0);
+	ASSERT(result.lost_bytes == 0);
+	ASSERT(result.read_bytes == stats.written_bytes);
+	ASSERT(stats.dropped_bytes == 0);
+}
+
+TEST_TEARDOWN(LOG_TAIL_TEARDOWN)
+{
+	if (RLM3_LogBuffer_IsInit())
+		RLM3_LogBuffer_Deinit();
+	SIM_LogMemory_UnmapFile();
+	::unlink(GetMemoryFilePath().c_str());
+}
@@ -0,0 +1,401 @@
+#include "Test.hpp"
+#include "rlm3-fw-communication.h"
+#include "rlm3-log-buffer.h"
+#include "rlm3-log-batcher.h"
+#include "rlm3-log-sink.h"
+#include "rlm3-log-decoder.hpp"
+#include "rlm3-memory.h"
+#include "rlm3-settings.h"
+#include "rlm3-task.h"
+#include "rlm3-timer.h"
+#include "rlm3-timer-ext-sim.hpp"
+#include "rlm3-sim.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+// Trace lines are "<ms> <T|I> <record>" where T runs the call from a task and I from an interrupt.  The record is one of
+//   L <level> <zone> <text>   a log message
+//   R <text>                  a raw message
+//   D <channel> <text>        the text followed by a newline through DebugChar
+// Blank lines and lines starting with '#' are ignored.  Times must not go backwards.  Calls in the same ms are spread
+// over the drain timer ticks of that ms, so the drain interrupt runs between them.
+static const char* SAMPLE_TRACE =
+	"# One second of a mowing session: the control loop, GPS sentences, IMU interrupts and a quiet period.\n"
+	"0 T L INFO CONTROL loop 0 speed 512 heading 1790 blade 3000\n"
+	"2 I D gps $GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47\n"
+	"3 I D gps $GPRMC,123519,A,4807.038,N,01131.000,E,022.4,084.4,230394,003.1,W*6A\n"
+	"5 I L DEBUG IMU sample ax -12 ay 4 az 1021 gx 3 gy -1 gz 0\n"
+	"5 I L DEBUG IMU sample ax -11 ay 5 az 1019 gx 2 gy -1 gz 0\n"
+	"5 I L DEBUG IMU sample ax -13 ay 3 az 1022 gx 3 gy 0 gz 1\n"
+	"6 T L INFO BATTERY voltage 25120 current 3400 temp 31\n"
+	"100 T L INFO CONTROL loop 1 speed 515 heading 1791 blade 3000\n"
+	"105 I L DEBUG IMU sample ax -12 ay 4 az 1020 gx 3 gy -1 gz 0\n"
+	"105 I L DEBUG IMU sample ax -10 ay 6 az 1018 gx 1 gy -2 gz 0\n"
+	"200 T L INFO CONTROL loop 2 speed 518 heading 1793 blade 3000\n"
+	"201 T L WARN MOTOR left current 4100 above soft limit 4000\n"
+	"205 I L DEBUG IMU sample ax -9 ay 7 az 1017 gx 2 gy -1 gz 1\n"
+	"205 I L DEBUG IMU sample ax -14 ay 2 az 1024 gx 4 gy 0 gz 0\n"
+	"205 I L DEBUG IMU sample ax -12 ay 4 az 1021 gx 3 gy -1 gz 0\n"
+	"205 I L DEBUG IMU sample ax -12 ay 5 az 1021 gx 3 gy -1 gz 0\n"
+	"300 T L INFO CONTROL loop 3 speed 520 heading 1794 blade 3000\n"
+	"302 T R R 17 OK\n"
+	"305 I L DEBUG IMU sample ax -12 ay 4 az 1021 gx 3 gy -1 gz 0\n"
+	"400 T L INFO CONTROL loop 4 speed 520 heading 1794 blade 3000\n"
+	"401 T L INFO WIFI rssi -67 channel 6 queued 3\n"
+	"405 I L DEBUG IMU sample ax -12 ay 4 az 1021 gx 3 gy -1 gz 0\n"
+	"500 T L INFO CONTROL loop 5 speed 519 heading 1795 blade 3000\n"
+	"502 I D gps $GPGSA,A,3,04,05,,09,12,,,24,,,,,2.5,1.3,2.1*39\n"
+	"505 I L DEBUG IMU sample ax -11 ay 4 az 1020 gx 2 gy -1 gz 0\n"
+	"505 I L DEBUG IMU sample ax -12 ay 3 az 1021 gx 3 gy -1 gz 0\n"
+	"505 I L DEBUG IMU sample ax -13 ay 4 az 1022 gx 3 gy 0 gz 0\n"
+	"600 T L INFO CONTROL loop 6 speed 517 heading 1796 blade 3000\n"
+	"605 I L DEBUG IMU sample ax -12 ay 4 az 1021 gx 3 gy -1 gz 0\n"
+	"700 T L INFO CONTROL loop 7 speed 516 heading 1797 blade 3000\n"
+	"701 T L INFO BATTERY voltage 25100 current 3450 temp 31\n"
+	"705 I L DEBUG IMU sample ax -12 ay 4 az 1021 gx 3 gy -1 gz 0\n"
+	"800 T L INFO CONTROL loop 8 speed 515 heading 1797 blade 3000\n"
+	"805 I L DEBUG IMU sample ax -12 ay 4 az 1021 gx 3 gy -1 gz 0\n"
+	"900 T L INFO CONTROL loop 9 speed 514 heading 1798 blade 3000\n"
+	"905 I L DEBUG IMU sample ax -12 ay 4 az 1021 gx 3 gy -1 gz 0\n"
+	"999 T L INFO CONTROL idle\n";
+
+
+struct TraceEvent
+{
+	RLM3_Time time;
+	bool is_isr;
+	char type;
+	const char* level;
+	const char* zone;
+	std::string text;
+};
+
+static constexpr size_t DRAIN_TICKS_PER_MS = 10;
+
+
+struct TraceReplayConfig
+{
+	size_t repeat_count = 1;
+	uint32_t console_bytes_per_second = 11520; // 115200 baud.
+	uint32_t console_burst = 256;
+	RLM3_Time link_latency = 50; // One way.
+	uint32_t link_bytes_per_second = 20000; // 0 if the link is down.
+	RLM3_Time occupancy_interval = 1000;
+};
+
+struct TraceReplayResult
+{
+	size_t event_count;
+	RLM3_Time duration;
+	RLM3_LogBufferStats stats;
+	size_t drain_interrupt_count;
+	size_t mean_used_size;
+	std::vector<size_t> occupancy; // Peak buffer use in each occupancy interval.
+	double mean_call_ns;
+	double p99_call_ns;
+	double max_call_ns;
+};
+
+
+static std::vector<TraceEvent> ParseTrace(std::istream& input, std::set<std::string>* names)
+{
+	// DebugChar tells channels apart by pointer, so every name is kept once for the life of the replay.
+	auto intern = [&](const std::string& name) { return names->insert(name).first->c_str(); };
+
+	std::vector<TraceEvent> result;
+	std::string line;
+	while (std::getline(input, line))
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+		std::istringstream fields(line);
+		TraceEvent event = {};
+		std::string context;
+		fields >> event.time >> context >> event.type;
+		ASSERT(!fields.fail() && (context == "T" || context == "I"));
+		ASSERT(result.empty() || event.time >= result.back().time);
+		event.is_isr = (context == "I");
+		std::string level, zone;
+		if (event.type == 'L')
+			fields >> level >> zone;
+		else if (event.type == 'D')
+			fields >> zone;
+		else
+			ASSERT(event.type == 'R');
+		ASSERT(!fields.fail());
+		event.level = intern(level);
+		event.zone = intern(zone);
+		fields >> std::ws;
+		std::getline(fields, event.text);
+		result.push_back(event);
+	}
+	return result;
+}
+
+static void RunEvent(const TraceEvent& event)
+{
+	switch (event.type)
+	{
+	case 'L':
+		RLM3_LogBuffer_FormatLogMessage(event.level, event.zone, "%s", event.text.c_str());
+		break;
+	case 'R':
+		RLM3_LogBuffer_FormatRawMessage("%s", event.text.c_str());
+		break;
+	case 'D':
+		for (char c : event.text)
+			RLM3_LogBuffer_DebugChar(event.zone, c);
+		RLM3_LogBuffer_DebugChar(event.zone, '\n');
+		break;
+	}
+}
+
+static void ExpectConsoleOutput(uint32_t* expected_end, LogInternTable* table)
+{
+	// The console sends every record written since the last call, without the intern definitions and with names in
+	// place of ids.
+	std::string log;
+	for (; *expected_end != EXTERNAL_MEMORY->log_head; (*expected_end)++)
+		log += EXTERNAL_MEMORY->log_buffer[*expected_end % sizeof(ExternalMemoryLayout::log_buffer)];
+	std::string expected;
+	for (size_t start = 0, end = 0; start < log.size(); start = end)
+	{
+		end = log.find('\n', start) + 1;
+		std::string_view line(log.data() + start, end - start);
+		LogRecord record;
+		ParseLogRecord(line, start, &record, table);
+		if (record.type == LogRecordType::INTERN)
+			continue;
+		if (line[0] == 'l')
+			expected += "L " + std::to_string(record.time) + " " + std::string(record.level) + " " + std::string(record.zone) + " " + std::string(record.text) + "\n";
+		else if (line[0] == 'd')
+			expected += "D " + std::string(record.zone) + " " + std::string(record.text) + "\n";
+		else
+			expected += line;
+	}
+	if (!expected.empty())
+		SIM_ExpectDebugOutput(expected.c_str());
+}
+
+static bool RunDrainTick(size_t tick)
+{
+	// The real drain interrupt feeds the debug console.  A throttled drain has its timer period stretched until the
+	// console budget refills, which is at least a ms, so it only runs on the first tick of each ms.
+	if (!SIM_Timer2_IsInterruptEnabled() || (RLM3_FwCommunication_IsDrainThrottled() && tick != 0))
+		return false;
+	SIM_DoInterrupt([] { RLM3_Timer2_Event_Callback(); });
+	return true;
+}
+
+static TraceReplayResult ReplayTrace(const std::vector<TraceEvent>& trace, const TraceReplayConfig& config)
+{
+	ASSERT(!trace.empty());
+
+	// The console and the uplink are the two readers of the log: the console through the communication module's drain
+	// interrupt, rate limited to the serial rate, and the uplink through the batcher over a link that releases the data
+	// once it is acknowledged.
+	RLM3_MEMORY_Init();
+	RLM3_LogSink_Filter console_filter = { RLM3_LOGSINK_LEVEL_TRACE, nullptr, 0, false, config.console_bytes_per_second, config.console_burst };
+	RLM3_FwCommunication_SetDebugConsoleFilter(&console_filter);
+	RLM3_FwCommunication_Init();
+	uint32_t expected_end = EXTERNAL_MEMORY->log_tail;
+	LogInternTable table;
+	RLM3_LogSink_Filter uplink_filter = { RLM3_LOGSINK_LEVEL_TRACE, nullptr, 0, false, 0, 0 };
+	RLM3_LogBatcher batcher;
+	RLM3_LogBatcher_Init(&batcher, &uplink_filter);
+	bool is_sending = false;
+	RLM3_Time ack_time = 0;
+
+	TraceReplayResult result = {};
+	std::vector<double> call_ns;
+	uint64_t used_sum = 0;
+	size_t interval_peak = 0;
+
+	RLM3_Time start_time = RLM3_GetCurrentTime();
+	RLM3_Time trace_length = trace.back().time + 1;
+	RLM3_Time duration = trace_length * config.repeat_count;
+	size_t next_event = 0;
+	for (RLM3_Time ms = 0; ms < duration; ms++)
+	{
+		// Replay everything that happened in this ms with its original context.
+		RLM3_Time offset = (ms / trace_length) * trace_length;
+		if (ms % trace_length == 0)
+			next_event = 0;
+		for (size_t tick = 0; tick < DRAIN_TICKS_PER_MS; tick++)
+		{
+			for (; next_event < trace.size() && trace[next_event].time + offset == ms; next_event++)
+			{
+				const TraceEvent& event = trace[next_event];
+				auto begin = std::chrono::steady_clock::now();
+				if (event.is_isr)
+					SIM_DoInterrupt([&] { RunEvent(event); });
+				else
+					RunEvent(event);
+				call_ns.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count());
+				result.event_count++;
+				ExpectConsoleOutput(&expected_end, &table);
+				if (tick + 1 < DRAIN_TICKS_PER_MS)
+				{
+					next_event++;
+					break;
+				}
+			}
+			if (RunDrainTick(tick))
+				result.drain_interrupt_count++;
+		}
+
+		// Move data over the uplink.
+		RLM3_Time now = RLM3_GetCurrentTime();
+		if (is_sending && now >= ack_time)
+		{
+			RLM3_LogBatcher_Acknowledge(&batcher);
+			is_sending = false;
+		}
+		if (!is_sending && config.link_bytes_per_second != 0 && RLM3_LogBatcher_Poll(&batcher))
+		{
+			is_sending = true;
+			size_t batch_size = 0;
+			const char* data;
+			while (size_t size = RLM3_LogBatcher_Peek(&batcher, &data))
+			{
+				RLM3_LogBatcher_Consume(&batcher, size);
+				batch_size += size;
+			}
+			ack_time = now + 2 * config.link_latency + (RLM3_Time)(1000 * (uint64_t)batch_size / config.link_bytes_per_second);
+		}
+
+		size_t used_size = EXTERNAL_MEMORY->log_head - EXTERNAL_MEMORY->log_tail;
+		used_sum += used_size;
+		interval_peak = std::max(interval_peak, used_size);
+		if ((ms + 1) % config.occupancy_interval == 0 || ms + 1 == duration)
+		{
+			result.occupancy.push_back(interval_peak);
+			interval_peak = 0;
+		}
+		RLM3_Delay(1);
+	}
+
+	result.duration = RLM3_GetCurrentTime() - start_time;
+	RLM3_LogBuffer_GetStats(&result.stats);
+
+	// Let the console finish so all of the expected output is sent.
+	for (size_t ms = 0; ms < 60000 && SIM_Timer2_IsInterruptEnabled(); ms++)
+	{
+		for (size_t tick = 0; tick < DRAIN_TICKS_PER_MS; tick++)
+			RunDrainTick(tick);
+		RLM3_Delay(1);
+	}
+	ASSERT(!RLM3_FwCommunication_IsDrainArmed());
+	result.mean_used_size = (size_t)(used_sum / duration);
+	std::sort(call_ns.begin(), call_ns.end());
+	for (double ns : call_ns)
+		result.mean_call_ns += ns / call_ns.size();
+	result.p99_call_ns = call_ns[call_ns.size() * 99 / 100];
+	result.max_call_ns = call_ns.back();
+	return result;
+}
+
+static void PrintReport(const char* name, const TraceReplayResult& result)
+{
+	std::printf("Log trace %s: %zu calls in %u ms, %u bytes written, %u dropped, %u overflows, %zu drain interrupts\n", name, result.event_count, (unsigned)result.duration,
+		(unsigned)result.stats.written_bytes, (unsigned)result.stats.dropped_bytes, (unsigned)result.stats.overflow_count, result.drain_interrupt_count);
+	std::printf("Log trace %s: buffer use mean %zu peak %u bytes, call cost mean %.0f p99 %.0f max %.0f ns\n", name, result.mean_used_size,
+		(unsigned)result.stats.peak_used_size, result.mean_call_ns, result.p99_call_ns, result.max_call_ns);
+	std::printf("Log trace %s: peak use per interval:", name);
+	for (size_t used_size : result.occupancy)
+		std::printf(" %zu", used_size);
+	std::printf("\n");
+}
+
+
+TEST_CASE(RLM3_LogTrace_Sample)
+{
+	std::istringstream input(SAMPLE_TRACE);
+	std::set<std::string> names;
+	std::vector<TraceEvent> trace = ParseTrace(input, &names);
+	TraceReplayConfig config;
+	config.repeat_count = 10;
+
+	TraceReplayResult result = ReplayTrace(trace, config);
+
+	PrintReport("sample", result);
+	ASSERT(result.event_count == 10 * trace.size());
+	ASSERT(result.stats.dropped_bytes == 0);
+	ASSERT(result.stats.overflow_count == 0);
+	ASSERT(result.drain_interrupt_count < result.stats.written_bytes);
+	ASSERT(result.stats.peak_used_size < 16 * 1024);
+}
+
+TEST_CASE(RLM3_LogTrace_LinkDown)
+{
+	std::istringstream input(SAMPLE_TRACE);
+	std::set<std::string> names;
+	std::vector<TraceEvent> trace = ParseTrace(input, &names);
+	TraceReplayConfig config;
+	config.repeat_count = 600;
+	config.link_bytes_per_second = 0;
+	config.occupancy_interval = 60000;
+
+	TraceReplayResult result = ReplayTrace(trace, config);
+
+	// Nothing frees any space, so the buffer fills up and stays full.
+	PrintReport("link down", result);
+	ASSERT(result.stats.overflow_count == 1);
+	ASSERT(result.stats.dropped_bytes > 0);
+	ASSERT(result.stats.written_bytes <= sizeof(ExternalMemoryLayout::log_buffer));
+}
+
+TEST_CASE(RLM3_LogTrace_File)
+{
+	// Replays a captured trace when one is given, for example: RLM3_TRACE_FILE=mowing.trace
+	const char* path = std::getenv("RLM3_TRACE_FILE");
+	if (path == nullptr)
+		return;
+	std::ifstream input(path);
+	ASSERT(input.good());
+	std::set<std::string> names;
+	std::vector<TraceEvent> trace = ParseTrace(input, &names);
+
+	TraceReplayResult result = ReplayTrace(trace, TraceReplayConfig());
+
+	PrintReport(path, result);
+}
+
+TEST_CASE(RLM3_LogTrace_ParseTrace)
+{
+	std::istringstream input("# comment\n\n0 T L INFO ZONE two words\n5 I D gps $GP\n5 T R R 1 OK\n");
+	std::set<std::string> names;
+
+	std::vector<TraceEvent> trace = ParseTrace(input, &names);
+
+	ASSERT(trace.size() == 3);
+	ASSERT(trace[0].time == 0 && !trace[0].is_isr && trace[0].type == 'L');
+	ASSERT(std::string(trace[0].level) == "INFO" && std::string(trace[0].zone) == "ZONE" && trace[0].text == "two words");
+	ASSERT(trace[1].time == 5 && trace[1].is_isr && trace[1].type == 'D');
+	ASSERT(std::string(trace[1].zone) == "gps" && trace[1].text == "$GP");
+	ASSERT(trace[2].type == 'R' && trace[2].text == "R 1 OK");
+}
+
+TEST_CASE(RLM3_LogTrace_ParseTrace_OutOfOrder)
+{
+	std::istringstream input("5 T R one\n4 T R two\n");
+	std::set<std::string> names;
+
+	ASSERT_ASSERTS(ParseTrace(input, &names));
+}
+
+TEST_TEARDOWN(LOG_TRACE_TEARDOWN)
+{
+	if (RLM3_FwCommunication_IsInit())
+		RLM3_FwCommunication_Deinit();
+	RLM3_LogSink_Filter filter = { RLM3_LOGSINK_LEVEL_TRACE, nullptr, 0, false, 0, 0 };
+	RLM3_FwCommunication_SetDebugConsoleFilter(&filter);
+}
@@ -0,0 +1,43 @@
+#include "rlm3-timer-ext-sim.hpp"
+#include "rlm3-timer.h"
+#include "Test.hpp"
+
+
+static bool g_is_interrupt_enabled = false;
+static uint32_t g_period_us = 0;
+
+
+extern void RLM3_Timer2_EnableInterrupt()
+{
+	ASSERT(RLM3_Timer2_IsInit());
+	g_is_interrupt_enabled = true;
+}
+
+extern void RLM3_Timer2_DisableInterrupt()
+{
+	ASSERT(RLM3_Timer2_IsInit());
+	g_is_interrupt_enabled = false;
+}
+
+extern void RLM3_Timer2_SetPeriod(uint32_t period_us)
+{
+	ASSERT(RLM3_Timer2_IsInit());
+	ASSERT(period_us != 0);
+	g_period_us = period_us;
+}
+
+extern bool SIM_Timer2_IsInterruptEnabled()
+{
+	return g_is_interrupt_enabled;
+}
+
+extern uint32_t SIM_Timer2_GetPeriod()
+{
+	return g_period_us;
+}
+
+TEST_TEARDOWN(TIMER_EXT_SIM_TEARDOWN)
+{
+	g_is_interrupt_enabled = false;
+	g_period_us = 0;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "rlm3-timer-ext.h"
+
+
+// Follows the Timer2 calls from rlm3-timer-ext.h, so tests can check what the firmware asked the timer to do.
+extern bool SIM_Timer2_IsInterruptEnabled();
+extern uint32_t SIM_Timer2_GetPeriod(); // 0 until the period is set.
@@ -0,0 +1,386 @@
+#include "rlm3-log-decoder.hpp"
+#include "rlm3-log-buffer.h"
+#include "rlm3-settings.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static constexpr uint32_t LOG_MAGIC = 0x4C4F474D; // 'LOGM'
+static constexpr uint32_t SNAPSHOT_MAGIC = 0x4C534E50; // 'LSNP'
+static constexpr uint16_t SNAPSHOT_VERSION = 2;
+static constexpr size_t SNAPSHOT_V1_HEADER_SIZE = offsetof(RLM3_LogSnapshotHeader, intern_offset);
+static constexpr size_t LOG_BUFFER_SIZE = sizeof(ExternalMemoryLayout::log_buffer);
+static constexpr size_t LOG_BUFFER_MASK = LOG_BUFFER_SIZE - 1;
+
+
+static uint32_t ReadU32(const uint8_t* data)
+{
+	uint32_t result;
+	std::memcpy(&result, data, sizeof(result));
+	return result;
+}
+
+static std::string_view NextToken(std::string_view& line)
+{
+	size_t end = line.find(' ');
+	if (end == std::string_view::npos)
+		end = line.size();
+	std::string_view result = line.substr(0, end);
+	line.remove_prefix(end < line.size() ? end + 1 : end);
+	return result;
+}
+
+static bool ParseNumber(std::string_view token, uint32_t* value)
+{
+	if (token.empty() || token.size() > 10 || token.find_first_not_of("0123456789") != std::string_view::npos)
+		return false;
+	uint64_t result = 0;
+	for (char c : token)
+		result = result * 10 + (c - '0');
+	*value = (uint32_t)result;
+	return true;
+}
+
+void LogInternTable::Define(uint32_t id, std::string_view name)
+{
+	// Redefining an id with the same name must not move the name that earlier records refer to.
+	auto it = m_names.find(id);
+	if (it == m_names.end())
+		m_names.emplace(id, std::string(name));
+	else if (it->second != name)
+		it->second = std::string(name);
+}
+
+std::string_view LogInternTable::Lookup(uint32_t id)
+{
+	auto it = m_names.find(id);
+	if (it != m_names.end())
+		return it->second;
+	auto unknown = m_unknown_names.find(id);
+	if (unknown == m_unknown_names.end())
+		unknown = m_unknown_names.emplace(id, "#" + std::to_string(id)).first;
+	return unknown->second;
+}
+
+extern void ParseLogRecord(std::string_view line, uint64_t offset, LogRecord* record, LogInternTable* table)
+{
+	*record = LogRecord();
+	record->type = LogRecordType::RAW;
+	record->offset = offset;
+	record->size = (uint32_t)line.size();
+	if (!line.empty() && line.back() == '\n')
+		line.remove_suffix(1);
+	record->text = line;
+
+	if (line.size() < 2 || line[1] != ' ')
+		return;
+
+	std::string_view rest = line.substr(2);
+	if (line[0] == 'L')
+	{
+		uint32_t time;
+		if (!ParseNumber(NextToken(rest), &time))
+			return;
+		std::string_view level = NextToken(rest);
+		std::string_view zone = NextToken(rest);
+		if (level.empty() || zone.empty())
+			return;
+		record->type = LogRecordType::LOG;
+		record->time = time;
+		record->level = level;
+		record->zone = zone;
+		record->text = rest;
+	}
+	else if (line[0] == 'l' && table != nullptr)
+	{
+		uint32_t time, level_id, zone_id;
+		if (!ParseNumber(NextToken(rest), &time) || !ParseNumber(NextToken(rest), &level_id) || !ParseNumber(NextToken(rest), &zone_id))
+			return;
+		record->type = LogRecordType::LOG;
+		record->time = time;
+		record->level = table->Lookup(level_id);
+		record->zone = table->Lookup(zone_id);
+		record->text = rest;
+	}
+	else if (line[0] == 'd' && table != nullptr)
+	{
+		uint32_t channel_id;
+		if (!ParseNumber(NextToken(rest), &channel_id))
+			return;
+		record->type = LogRecordType::DEBUG;
+		record->zone = table->Lookup(channel_id);
+		record->text = rest;
+	}
+	else if (line[0] == 'I')
+	{
+		std::string_view id = NextToken(rest);
+		uint32_t value;
+		if (!ParseNumber(id, &value) || rest.empty())
+			return;
+		record->type = LogRecordType::INTERN;
+		record->zone = id;
+		record->text = rest;
+		if (table != nullptr)
+			table->Define(value, rest);
+	}
+	else if (line[0] == 'D' || line[0] == 'R')
+	{
+		std::string_view name = NextToken(rest);
+		if (name.empty())
+			return;
+		record->type = (line[0] == 'D') ? LogRecordType::DEBUG : LogRecordType::RESPONSE;
+		record->zone = name;
+		record->text = rest;
+	}
+}
+
+LogSource::~LogSource()
+{
+	Close();
+}
+
+bool LogSource::Open(const char* path)
+{
+	Close();
+
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		m_error = std::string("unable to open '") + path + "': " + std::strerror(errno);
+		return false;
+	}
+	struct stat info;
+	if (::fstat(fd, &info) != 0)
+	{
+		m_error = std::string("unable to stat '") + path + "': " + std::strerror(errno);
+		::close(fd);
+		return false;
+	}
+	if (info.st_size > 0)
+	{
+		void* data = ::mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			m_error = std::string("unable to map '") + path + "': " + std::strerror(errno);
+			::close(fd);
+			return false;
+		}
+		::madvise(data, info.st_size, MADV_SEQUENTIAL);
+		m_data = (const uint8_t*)data;
+		m_is_mapped = true;
+	}
+	m_data_size = info.st_size;
+	::close(fd);
+	return Detect();
+}
+
+bool LogSource::OpenMemory(const void* data, size_t size)
+{
+	Close();
+	m_data = (const uint8_t*)data;
+	m_data_size = size;
+	return Detect();
+}
+
+void LogSource::Close()
+{
+	if (m_is_mapped)
+		::munmap((void*)m_data, m_data_size);
+	m_data = nullptr;
+	m_data_size = 0;
+	m_is_mapped = false;
+	m_is_memory_dump = false;
+	m_is_snapshot = false;
+	m_snapshot = RLM3_LogSnapshotHeader();
+	m_spans[0] = m_spans[1] = std::string_view();
+	m_released_spans[0] = m_released_spans[1] = std::string_view();
+	m_error.clear();
+}
+
+bool LogSource::Detect()
+{
+	const char* chars = (const char*)m_data;
+	if (m_data_size == sizeof(ExternalMemoryLayout) && ReadU32(m_data + offsetof(ExternalMemoryLayout, log_magic)) == LOG_MAGIC)
+	{
+		uint32_t head = ReadU32(m_data + offsetof(ExternalMemoryLayout, log_head));
+		uint32_t tail = ReadU32(m_data + offsetof(ExternalMemoryLayout, log_tail));
+		if (head - tail > LOG_BUFFER_SIZE)
+		{
+			m_error = "memory dump has an invalid log head and tail";
+			return false;
+		}
+		const char* buffer = chars + offsetof(ExternalMemoryLayout, log_buffer);
+		size_t start = tail & LOG_BUFFER_MASK;
+		size_t size = head - tail;
+		size_t first = std::min(size, LOG_BUFFER_SIZE - start);
+		m_spans[0] = std::string_view(buffer + start, first);
+		m_spans[1] = std::string_view(buffer, size - first);
+
+		// The rest of the ring holds released data that has not been written over yet, oldest first from the head.
+		size_t released_start = head & LOG_BUFFER_MASK;
+		size_t released_size = LOG_BUFFER_SIZE - size;
+		size_t released_first = std::min(released_size, LOG_BUFFER_SIZE - released_start);
+		m_released_spans[0] = std::string_view(buffer + released_start, released_first);
+		m_released_spans[1] = std::string_view(buffer, released_size - released_first);
+		m_is_memory_dump = true;
+		return true;
+	}
+
+	if (m_data_size >= sizeof(uint32_t) && ReadU32(m_data) == SNAPSHOT_MAGIC)
+	{
+		// Only read the fields this version knows about.  Newer versions may have a larger header.  Version 1 had no intern
+		// table.
+		if (m_data_size < SNAPSHOT_V1_HEADER_SIZE)
+		{
+			m_error = "snapshot is truncated";
+			return false;
+		}
+		std::memcpy(&m_snapshot, m_data, SNAPSHOT_V1_HEADER_SIZE);
+		size_t header_size = (m_snapshot.version == 1) ? SNAPSHOT_V1_HEADER_SIZE : sizeof(RLM3_LogSnapshotHeader);
+		if (m_snapshot.version == 0 || m_snapshot.version > SNAPSHOT_VERSION || m_snapshot.header_size < header_size)
+		{
+			m_error = "snapshot version " + std::to_string(m_snapshot.version) + " is not supported";
+			return false;
+		}
+		if (m_data_size < header_size)
+		{
+			m_error = "snapshot is truncated";
+			return false;
+		}
+		std::memcpy(&m_snapshot, m_data, header_size);
+		if ((uint64_t)m_snapshot.data_offset + m_snapshot.data_size > m_data_size ||
+			(uint64_t)m_snapshot.intern_offset + m_snapshot.intern_size > m_data_size ||
+			(uint64_t)m_snapshot.fault_cause_offset + m_snapshot.fault_cause_size > m_data_size ||
+			(uint64_t)m_snapshot.fault_thread_state_offset + m_snapshot.fault_thread_state_size > m_data_size)
+		{
+			m_error = "snapshot is truncated";
+			return false;
+		}
+		m_spans[0] = std::string_view(chars + m_snapshot.data_offset, m_snapshot.data_size);
+		m_is_snapshot = true;
+		return true;
+	}
+
+	m_spans[0] = std::string_view(chars, m_data_size);
+	return true;
+}
+
+std::string_view LogSource::GetSnapshotField(uint32_t offset, uint32_t size) const
+{
+	if (!m_is_snapshot)
+		return std::string_view();
+	std::string_view field((const char*)m_data + offset, size);
+	return field.substr(0, field.find('\0'));
+}
+
+std::string_view LogSource::Read(uint64_t offset, size_t size, std::string& scratch) const
+{
+	uint64_t first = m_spans[0].size();
+	if (offset + size <= first)
+		return m_spans[0].substr(offset, size);
+	if (offset >= first)
+		return m_spans[1].substr(offset - first, size);
+	scratch.assign(m_spans[0].substr(offset));
+	scratch.append(m_spans[1].substr(0, size - (first - offset)));
+	return scratch;
+}
+
+void LogSource::LoadReleasedDefinitions(LogInternTable* table) const
+{
+	// The oldest released record was partly written over, so start at the first whole one, unless that part of the
+	// ring was never written.  Later definitions replace earlier ones, the same as in the stream.
+	std::string released(m_released_spans[0]);
+	released.append(m_released_spans[1]);
+	size_t start = released.find_first_not_of('\0');
+	if (start == 0)
+		start = released.find('\n');
+	else if (start != std::string::npos)
+		start--;
+	LogRecord record;
+	while (start != std::string::npos && start + 1 < released.size())
+	{
+		// start is just before the next record.
+		size_t end = released.find('\n', start + 1);
+		if (end == std::string::npos)
+			break;
+		std::string_view line(released.data() + start + 1, end - start);
+		if (line.size() >= 2 && line[0] == 'I' && line[1] == ' ')
+			ParseLogRecord(line, 0, &record, table);
+		start = end;
+	}
+}
+
+void LogSource::LoadSnapshotInternTable(LogInternTable* table) const
+{
+	// The table is a run of "I <id> <name>\n" records.
+	LogRecord record;
+	std::string_view intern((const char*)m_data + m_snapshot.intern_offset, m_snapshot.intern_size);
+	while (!intern.empty())
+	{
+		size_t end = intern.find('\n');
+		end = (end != std::string_view::npos) ? end + 1 : intern.size();
+		ParseLogRecord(intern.substr(0, end), 0, &record, table);
+		intern.remove_prefix(end);
+	}
+}
+
+uint64_t LogSource::Decode(const std::function<void(const LogRecord&)>& fn) const
+{
+	uint64_t count = 0;
+	uint64_t base = 0;
+	uint64_t line_start = 0;
+	std::string carry;
+	LogRecord record;
+	LogInternTable table;
+	bool is_table_loaded = !m_is_snapshot || m_snapshot.intern_size == 0;
+	if (m_is_memory_dump)
+		LoadReleasedDefinitions(&table);
+	for (const std::string_view& span : m_spans)
+	{
+		const char* p = span.data();
+		const char* end = p + span.size();
+		while (p < end)
+		{
+			const char* newline = (const char*)std::memchr(p, '\n', end - p);
+			if (newline == nullptr)
+			{
+				// The record continues in the next span.
+				carry.append(p, end);
+				break;
+			}
+			std::string_view line(p, newline + 1 - p);
+			if (!carry.empty())
+			{
+				carry.append(line);
+				line = carry;
+			}
+			if (!is_table_loaded && line_start >= m_snapshot.session_offset)
+			{
+				LoadSnapshotInternTable(&table);
+				is_table_loaded = true;
+			}
+			ParseLogRecord(line, line_start, &record, &table);
+			fn(record);
+			count++;
+			carry.clear();
+			line_start = base + (newline + 1 - span.data());
+			p = newline + 1;
+		}
+		base += span.size();
+	}
+	if (!carry.empty())
+	{
+		// The capture ends in the middle of a record.
+		if (!is_table_loaded && line_start >= m_snapshot.session_offset)
+			LoadSnapshotInternTable(&table);
+		ParseLogRecord(carry, line_start, &record, &table);
+		fn(record);
+		count++;
+	}
+	return count;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "rlm3-log-buffer.h"
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+
+
+enum class LogRecordType : uint8_t
+{
+	LOG = 'L',      // "L <time> <level> <zone> <text>" or "l <time> <level_id> <zone_id> <text>"
+	DEBUG = 'D',    // "D <channel> <text>" or "d <channel_id> <text>"
+	RESPONSE = 'R', // "R <id> <text>"
+	INTERN = 'I',   // "I <id> <name>"
+	RAW = 'T',      // Anything else.
+};
+
+struct LogRecord
+{
+	LogRecordType type;
+	uint64_t offset; // Position of the record in the decoded stream.
+	uint32_t size; // Size of the record including the newline.
+	uint32_t time;
+	std::string_view level;
+	std::string_view zone; // Channel for DEBUG records and id for RESPONSE and INTERN records.
+	std::string_view text;
+};
+
+// Names for the interned ids seen so far in a stream.  Ids that have not been defined are shown as "#<id>".  Returned
+// names stay valid for the life of the table.
+class LogInternTable
+{
+public:
+	void Define(uint32_t id, std::string_view name);
+	std::string_view Lookup(uint32_t id);
+	void Clear() { m_names.clear(); m_unknown_names.clear(); }
+
+private:
+	std::map<uint32_t, std::string> m_names;
+	std::map<uint32_t, std::string> m_unknown_names;
+};
+
+// A memory mapped log capture.  This is either a raw dump of ExternalMemoryLayout, in which case the stream is the
+// log ring from log_tail to log_head, a snapshot container from RLM3_LogBuffer_BeginSnapshot, or a captured uplink
+// stream which is used as is.  Decoding a snapshot uses its intern table for the records of the current session, and
+// decoding a dump first picks up the definitions left in the released part of the ring.
+class LogSource
+{
+public:
+	LogSource() = default;
+	LogSource(const LogSource&) = delete;
+	LogSource& operator=(const LogSource&) = delete;
+	~LogSource();
+
+	bool Open(const char* path);
+	bool OpenMemory(const void* data, size_t size);
+	void Close();
+
+	const std::string& GetError() const { return m_error; }
+	bool IsMemoryDump() const { return m_is_memory_dump; }
+	bool IsSnapshot() const { return m_is_snapshot; }
+	const RLM3_LogSnapshotHeader& GetSnapshotHeader() const { return m_snapshot; }
+	std::string_view GetSnapshotFaultCause() const { return GetSnapshotField(m_snapshot.fault_cause_offset, m_snapshot.fault_cause_size); }
+	std::string_view GetSnapshotFaultThreadState() const { return GetSnapshotField(m_snapshot.fault_thread_state_offset, m_snapshot.fault_thread_state_size); }
+	uint64_t GetSize() const { return m_spans[0].size() + m_spans[1].size(); }
+	uint64_t GetSourceSize() const { return m_data_size; }
+
+	// Returns the stream bytes at [offset, offset + size).  Bytes are only copied into scratch if they cross the wrap of the ring.
+	std::string_view Read(uint64_t offset, size_t size, std::string& scratch) const;
+
+	// Calls fn for every newline terminated record in the stream.  Returns the number of records.
+	uint64_t Decode(const std::function<void(const LogRecord&)>& fn) const;
+
+private:
+	bool Detect();
+	std::string_view GetSnapshotField(uint32_t offset, uint32_t size) const;
+	void LoadSnapshotInternTable(LogInternTable* table) const;
+	void LoadReleasedDefinitions(LogInternTable* table) const;
+
+	const uint8_t* m_data = nullptr;
+	size_t m_data_size = 0;
+	bool m_is_mapped = false;
+	bool m_is_memory_dump = false;
+	bool m_is_snapshot = false;
+	RLM3_LogSnapshotHeader m_snapshot = {};
+	std::string_view m_spans[2];
+	std::string_view m_released_spans[2];
+	std::string m_error;
+};
+
+// Interned records are only decoded when a table is given.  INTERN records update the table.
+extern void ParseLogRecord(std::string_view line, uint64_t offset, LogRecord* record, LogInternTable* table = nullptr);
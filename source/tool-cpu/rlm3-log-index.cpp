@@ -0,0 +1,436 @@
+#include "rlm3-log-index.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static constexpr char INDEX_MAGIC[4] = { 'R', 'L', 'I', 'X' };
+static constexpr uint32_t INDEX_VERSION = 2;
+static constexpr size_t MAX_STRING_COUNT = 0xFFFF;
+
+
+// Sorts (key, value) pairs with a bounded amount of memory.  Each full run is sorted and appended to a temporary file,
+// and Merge combines the runs in order.
+class RunSorter
+{
+public:
+	explicit RunSorter(size_t run_size) : m_run_size(std::max<size_t>(run_size, 1)) {}
+	RunSorter(const RunSorter&) = delete;
+	RunSorter& operator=(const RunSorter&) = delete;
+	~RunSorter();
+
+	bool Add(uint64_t key, uint64_t value);
+	bool Merge(const std::function<void(uint64_t key, uint64_t value)>& fn);
+
+private:
+	typedef std::pair<uint64_t, uint64_t> Item;
+
+	struct Reader
+	{
+		uint64_t next; // Position in the file of the next item to buffer.
+		uint64_t end;
+		std::vector<Item> buffer;
+		size_t position;
+	};
+
+	static constexpr size_t READ_BUFFER_SIZE = 4096;
+
+	bool Spill();
+	bool Fill(Reader& reader);
+
+	size_t m_run_size;
+	std::vector<Item> m_run;
+	std::vector<std::pair<uint64_t, uint64_t>> m_runs; // First item and item count of each run in the file.
+	uint64_t m_file_size = 0;
+	FILE* m_file = nullptr;
+};
+
+RunSorter::~RunSorter()
+{
+	if (m_file != nullptr)
+		std::fclose(m_file);
+}
+
+bool RunSorter::Add(uint64_t key, uint64_t value)
+{
+	m_run.emplace_back(key, value);
+	return m_run.size() < m_run_size || Spill();
+}
+
+bool RunSorter::Spill()
+{
+	if (m_file == nullptr && (m_file = std::tmpfile()) == nullptr)
+		return false;
+	std::sort(m_run.begin(), m_run.end());
+	if (std::fwrite(m_run.data(), sizeof(Item), m_run.size(), m_file) != m_run.size())
+		return false;
+	m_runs.emplace_back(m_file_size, m_run.size());
+	m_file_size += m_run.size();
+	m_run.clear();
+	return true;
+}
+
+bool RunSorter::Fill(Reader& reader)
+{
+	size_t count = (size_t)std::min<uint64_t>(reader.end - reader.next, READ_BUFFER_SIZE);
+	reader.buffer.resize(count);
+	reader.position = 0;
+	ssize_t size = ::pread(::fileno(m_file), reader.buffer.data(), count * sizeof(Item), reader.next * sizeof(Item));
+	reader.next += count;
+	return size == (ssize_t)(count * sizeof(Item));
+}
+
+bool RunSorter::Merge(const std::function<void(uint64_t key, uint64_t value)>& fn)
+{
+	// Everything fit in one run, so there is nothing to merge.
+	if (m_file == nullptr)
+	{
+		std::sort(m_run.begin(), m_run.end());
+		for (const Item& item : m_run)
+			fn(item.first, item.second);
+		return true;
+	}
+	if (!m_run.empty() && !Spill())
+		return false;
+	if (std::fflush(m_file) != 0)
+		return false;
+
+	std::vector<Reader> readers(m_runs.size());
+	auto is_after = [&](size_t a, size_t b) { return readers[a].buffer[readers[a].position] > readers[b].buffer[readers[b].position]; };
+	std::priority_queue<size_t, std::vector<size_t>, decltype(is_after)> queue(is_after);
+	for (size_t i = 0; i < m_runs.size(); i++)
+	{
+		readers[i].next = m_runs[i].first;
+		readers[i].end = m_runs[i].first + m_runs[i].second;
+		if (!Fill(readers[i]))
+			return false;
+		queue.push(i);
+	}
+	while (!queue.empty())
+	{
+		size_t i = queue.top();
+		queue.pop();
+		Reader& reader = readers[i];
+		const Item& item = reader.buffer[reader.position++];
+		fn(item.first, item.second);
+		if (reader.position == reader.buffer.size())
+		{
+			if (reader.next == reader.end)
+				continue;
+			if (!Fill(reader))
+				return false;
+		}
+		queue.push(i);
+	}
+	return true;
+}
+
+extern bool WriteLogIndex(const LogSource& source, const char* path, std::string* error, size_t run_size)
+{
+	FILE* file = std::fopen(path, "wb");
+	if (file == nullptr)
+	{
+		*error = std::string("unable to create '") + path + "': " + std::strerror(errno);
+		return false;
+	}
+
+	LogIndexHeader header = {};
+	std::memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+	header.version = INDEX_VERSION;
+	header.source_size = source.GetSize();
+	std::fwrite(&header, sizeof(header), 1, file);
+
+	// Entries are streamed out as the source is decoded.  The time ordering and the postings go through run sorters, and
+	// only the strings and the length of each posting list are kept in memory.
+	RunSorter time_order(run_size);
+	RunSorter postings(run_size); // Keyed by the posting list, which is the level then the zone for each string id.
+	uint64_t time_order_count = 0;
+	std::vector<uint64_t> posting_counts(2);
+	bool is_sort_ok = true;
+	std::unordered_map<std::string_view, uint16_t> string_ids;
+	std::deque<std::string> strings; // A deque keeps the keys of string_ids valid as it grows.
+	bool is_string_overflow = false;
+	auto intern = [&](std::string_view value) -> uint16_t
+	{
+		if (value.empty())
+			return 0;
+		auto it = string_ids.find(value);
+		if (it != string_ids.end())
+			return it->second;
+		if (strings.size() >= MAX_STRING_COUNT)
+		{
+			is_string_overflow = true;
+			return 0;
+		}
+		strings.emplace_back(value);
+		uint16_t id = (uint16_t)strings.size();
+		string_ids.emplace(strings.back(), id);
+		posting_counts.resize(2 * (strings.size() + 1));
+		return id;
+	};
+
+	source.Decode([&](const LogRecord& record)
+	{
+		// Interned names are resolved by the decoder, so the definitions themselves are not needed.
+		if (record.type == LogRecordType::INTERN)
+			return;
+		LogIndexEntry entry = {};
+		entry.offset = record.offset;
+		entry.size = record.size;
+		entry.time = record.time;
+		entry.level = intern(record.level);
+		entry.zone = intern(record.zone);
+		entry.type = (uint8_t)record.type;
+		// Entry numbers only grow, so sorting by time and then entry number keeps records with the same time in
+		// stream order, and each posting list comes out in stream order.
+		if (record.type == LogRecordType::LOG)
+		{
+			is_sort_ok &= time_order.Add(record.time, header.entry_count);
+			time_order_count++;
+		}
+		is_sort_ok &= postings.Add(2 * entry.level, header.entry_count);
+		is_sort_ok &= postings.Add(2 * entry.zone + 1, header.entry_count);
+		posting_counts[2 * entry.level]++;
+		posting_counts[2 * entry.zone + 1]++;
+		std::fwrite(&entry, sizeof(entry), 1, file);
+		header.entry_count++;
+	});
+
+	header.time_order_offset = sizeof(header) + header.entry_count * sizeof(LogIndexEntry);
+	is_sort_ok &= time_order.Merge([&](uint64_t, uint64_t entry) { std::fwrite(&entry, sizeof(entry), 1, file); });
+	header.posting_table_offset = header.time_order_offset + time_order_count * sizeof(uint64_t);
+	LogIndexPostingList list = {};
+	for (uint64_t count : posting_counts)
+	{
+		list.count = count;
+		std::fwrite(&list, sizeof(list), 1, file);
+		list.first += list.count;
+	}
+	header.postings_offset = header.posting_table_offset + posting_counts.size() * sizeof(LogIndexPostingList);
+	is_sort_ok &= postings.Merge([&](uint64_t, uint64_t entry) { std::fwrite(&entry, sizeof(entry), 1, file); });
+	header.strings_offset = header.postings_offset + list.first * sizeof(uint64_t);
+	header.string_count = strings.size();
+	for (const std::string& value : strings)
+	{
+		uint16_t length = (uint16_t)std::min<size_t>(value.size(), 0xFFFF);
+		std::fwrite(&length, sizeof(length), 1, file);
+		std::fwrite(value.data(), 1, length, file);
+	}
+
+	std::fseek(file, 0, SEEK_SET);
+	std::fwrite(&header, sizeof(header), 1, file);
+	bool is_ok = !std::ferror(file);
+	is_ok &= (std::fclose(file) == 0);
+	if (!is_sort_ok)
+		*error = "unable to sort the index in temporary files";
+	else if (!is_ok)
+		*error = std::string("unable to write '") + path + "'";
+	else if (is_string_overflow)
+		*error = "too many distinct level, zone and channel names; some were not indexed";
+	return is_ok && is_sort_ok;
+}
+
+LogIndex::~LogIndex()
+{
+	Close();
+}
+
+bool LogIndex::Open(const char* path, const LogSource& source)
+{
+	Close();
+
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		m_error = std::string("unable to open '") + path + "': " + std::strerror(errno);
+		return false;
+	}
+	struct stat info;
+	if (::fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(LogIndexHeader))
+	{
+		m_error = std::string("'") + path + "' is not a log index";
+		::close(fd);
+		return false;
+	}
+	void* data = ::mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED)
+	{
+		m_error = std::string("unable to map '") + path + "': " + std::strerror(errno);
+		return false;
+	}
+	m_data = (const uint8_t*)data;
+	m_size = info.st_size;
+	m_header = (const LogIndexHeader*)m_data;
+
+	if (std::memcmp(m_header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || m_header->version != INDEX_VERSION)
+	{
+		m_error = std::string("'") + path + "' is not a supported log index";
+		Close();
+		return false;
+	}
+	// Check the counts against the file size first so the offsets computed from them cannot overflow.
+	if (m_header->entry_count > (m_size - sizeof(LogIndexHeader)) / sizeof(LogIndexEntry) ||
+		m_header->string_count > MAX_STRING_COUNT)
+	{
+		m_error = std::string("'") + path + "' is corrupt";
+		Close();
+		return false;
+	}
+	uint64_t posting_table_size = 2 * (m_header->string_count + 1) * sizeof(LogIndexPostingList);
+	if (m_header->time_order_offset != sizeof(LogIndexHeader) + m_header->entry_count * sizeof(LogIndexEntry) ||
+		m_header->posting_table_offset < m_header->time_order_offset ||
+		(m_header->posting_table_offset - m_header->time_order_offset) / sizeof(uint64_t) > m_header->entry_count ||
+		m_header->postings_offset != m_header->posting_table_offset + posting_table_size ||
+		m_header->strings_offset < m_header->postings_offset ||
+		m_header->strings_offset > m_size)
+	{
+		m_error = std::string("'") + path + "' is corrupt";
+		Close();
+		return false;
+	}
+	if (m_header->source_size != source.GetSize())
+	{
+		m_error = std::string("'") + path + "' was built for a different capture";
+		Close();
+		return false;
+	}
+
+	m_entries = (const LogIndexEntry*)(m_data + sizeof(LogIndexHeader));
+	m_time_order = (const uint64_t*)(m_data + m_header->time_order_offset);
+	m_posting_table = (const LogIndexPostingList*)(m_data + m_header->posting_table_offset);
+	m_postings = (const uint64_t*)(m_data + m_header->postings_offset);
+	uint64_t posting_count = (m_header->strings_offset - m_header->postings_offset) / sizeof(uint64_t);
+	for (uint64_t i = 0; i < 2 * (m_header->string_count + 1); i++)
+	{
+		if (m_posting_table[i].first > posting_count || m_posting_table[i].count > posting_count - m_posting_table[i].first)
+		{
+			m_error = std::string("'") + path + "' is corrupt";
+			Close();
+			return false;
+		}
+	}
+	const uint8_t* p = m_data + m_header->strings_offset;
+	const uint8_t* end = m_data + m_size;
+	m_strings.push_back(std::string_view());
+	for (uint64_t i = 0; i < m_header->string_count; i++)
+	{
+		uint16_t length;
+		if (end - p < (ptrdiff_t)sizeof(length))
+			break;
+		std::memcpy(&length, p, sizeof(length));
+		p += sizeof(length);
+		if (end - p < length)
+			break;
+		m_strings.push_back(std::string_view((const char*)p, length));
+		p += length;
+	}
+	if (m_strings.size() != m_header->string_count + 1)
+	{
+		m_error = std::string("'") + path + "' is corrupt";
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void LogIndex::Close()
+{
+	if (m_data != nullptr)
+		::munmap((void*)m_data, m_size);
+	m_data = nullptr;
+	m_size = 0;
+	m_header = nullptr;
+	m_entries = nullptr;
+	m_time_order = nullptr;
+	m_posting_table = nullptr;
+	m_postings = nullptr;
+	m_strings.clear();
+}
+
+std::string_view LogIndex::GetString(uint16_t id) const
+{
+	return (id < m_strings.size()) ? m_strings[id] : std::string_view();
+}
+
+uint16_t LogIndex::FindString(const std::string& value) const
+{
+	for (size_t i = 1; i < m_strings.size(); i++)
+		if (m_strings[i] == value)
+			return (uint16_t)i;
+	return 0;
+}
+
+uint64_t LogIndex::Query(const LogQuery& query, const std::function<void(const LogIndexEntry&)>& fn) const
+{
+	uint16_t level = 0;
+	uint16_t zone = 0;
+	if (!query.level.empty() && (level = FindString(query.level)) == 0)
+		return 0;
+	if (!query.zone.empty() && (zone = FindString(query.zone)) == 0)
+		return 0;
+
+	uint64_t count = 0;
+	auto visit = [&](const LogIndexEntry& entry)
+	{
+		if (level != 0 && entry.level != level)
+			return;
+		if (zone != 0 && entry.zone != zone)
+			return;
+		if (query.type != 0 && entry.type != (uint8_t)query.type)
+			return;
+		if (query.has_time_range && (entry.type != (uint8_t)LogRecordType::LOG || entry.time < query.time_from || entry.time > query.time_to))
+			return;
+		fn(entry);
+		count++;
+	};
+
+	// Start from the shortest of the level and zone posting lists and the time range.
+	const LogIndexPostingList* list = nullptr;
+	if (level != 0)
+		list = &GetPostingList(level, false);
+	if (zone != 0 && (list == nullptr || GetPostingList(zone, true).count < list->count))
+		list = &GetPostingList(zone, true);
+
+	const uint64_t* first = nullptr;
+	const uint64_t* last = nullptr;
+	if (query.has_time_range)
+	{
+		const uint64_t* order_begin = m_time_order;
+		const uint64_t* order_end = m_time_order + (m_header->posting_table_offset - m_header->time_order_offset) / sizeof(uint64_t);
+		first = std::lower_bound(order_begin, order_end, query.time_from, [&](uint64_t i, uint32_t t) { return m_entries[i].time < t; });
+		last = std::upper_bound(first, order_end, query.time_to, [&](uint32_t t, uint64_t i) { return t < m_entries[i].time; });
+	}
+
+	if (list != nullptr && (!query.has_time_range || list->count <= (uint64_t)(last - first)))
+	{
+		for (uint64_t i = list->first; i < list->first + list->count; i++)
+			if (m_postings[i] < m_header->entry_count)
+				visit(m_entries[m_postings[i]]);
+		return count;
+	}
+
+	if (!query.has_time_range)
+	{
+		for (uint64_t i = 0; i < m_header->entry_count; i++)
+			visit(m_entries[i]);
+		return count;
+	}
+
+	// Report the matches in the time range in stream order.
+	std::vector<uint64_t> matches(first, last);
+	std::sort(matches.begin(), matches.end());
+	for (uint64_t i : matches)
+		if (i < m_header->entry_count)
+			visit(m_entries[i]);
+	return count;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "rlm3-log-decoder.hpp"
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// On disk layout: LogIndexHeader, entry_count LogIndexEntry records in stream order, the uint64_t entry numbers of the
+// log records sorted by time, the posting table, the postings, then string_count strings each stored as a uint16_t
+// length followed by the characters.  The posting table has a LogIndexPostingList for the level and then the zone of
+// each string id (including 0), and each list is a run of uint64_t entry numbers in stream order in the postings.
+struct LogIndexHeader
+{
+	char magic[4]; // "RLIX"
+	uint32_t version;
+	uint64_t source_size;
+	uint64_t entry_count;
+	uint64_t string_count;
+	uint64_t time_order_offset;
+	uint64_t posting_table_offset;
+	uint64_t postings_offset;
+	uint64_t strings_offset;
+};
+
+struct LogIndexPostingList
+{
+	uint64_t first; // Position of the first entry number in the postings.
+	uint64_t count;
+};
+
+struct LogIndexEntry
+{
+	uint64_t offset;
+	uint32_t size;
+	uint32_t time;
+	uint16_t level; // String id, 0 if none.
+	uint16_t zone; // String id, 0 if none.
+	uint8_t type; // LogRecordType
+	uint8_t reserved[3];
+};
+
+static_assert(sizeof(LogIndexEntry) == 24, "Index entries are stored on disk.");
+
+struct LogQuery
+{
+	bool has_time_range = false;
+	uint32_t time_from = 0;
+	uint32_t time_to = 0;
+	std::string level;
+	std::string zone;
+	char type = 0;
+};
+
+// The time ordering and the postings are sorted in runs of at most run_size items that are spilled to temporary files and
+// merged, so the memory used does not grow with the capture.
+static constexpr size_t LOG_INDEX_RUN_SIZE = 1 << 20;
+
+extern bool WriteLogIndex(const LogSource& source, const char* path, std::string* error, size_t run_size = LOG_INDEX_RUN_SIZE);
+
+class LogIndex
+{
+public:
+	LogIndex() = default;
+	LogIndex(const LogIndex&) = delete;
+	LogIndex& operator=(const LogIndex&) = delete;
+	~LogIndex();
+
+	bool Open(const char* path, const LogSource& source);
+	void Close();
+
+	const std::string& GetError() const { return m_error; }
+	uint64_t GetEntryCount() const { return m_header->entry_count; }
+	std::string_view GetString(uint16_t id) const;
+
+	// Calls fn for each matching entry in stream order.  Returns the number of matches.
+	uint64_t Query(const LogQuery& query, const std::function<void(const LogIndexEntry&)>& fn) const;
+
+private:
+	uint16_t FindString(const std::string& value) const;
+	const LogIndexPostingList& GetPostingList(uint16_t id, bool is_zone) const { return m_posting_table[2 * id + (is_zone ? 1 : 0)]; }
+
+	const uint8_t* m_data = nullptr;
+	size_t m_size = 0;
+	const LogIndexHeader* m_header = nullptr;
+	const LogIndexEntry* m_entries = nullptr;
+	const uint64_t* m_time_order = nullptr;
+	const LogIndexPostingList* m_posting_table = nullptr;
+	const uint64_t* m_postings = nullptr;
+	std::vector<std::string_view> m_strings;
+	std::string m_error;
+};
@@ -0,0 +1,117 @@
+#include "rlm3-log-tail.hpp"
+#include "rlm3-settings.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static constexpr size_t LOG_BUFFER_SIZE = sizeof(ExternalMemoryLayout::log_buffer);
+static constexpr size_t LOG_BUFFER_MASK = LOG_BUFFER_SIZE - 1;
+
+
+LogTail::~LogTail()
+{
+	Close();
+}
+
+bool LogTail::Open(const char* path, bool is_consuming)
+{
+	Close();
+
+	int fd = ::open(path, is_consuming ? O_RDWR : O_RDONLY);
+	if (fd < 0)
+	{
+		m_error = std::string("unable to open '") + path + "': " + std::strerror(errno);
+		return false;
+	}
+	struct stat info;
+	if (::fstat(fd, &info) != 0)
+	{
+		m_error = std::string("unable to stat '") + path + "': " + std::strerror(errno);
+		::close(fd);
+		return false;
+	}
+	if ((size_t)info.st_size < sizeof(ExternalMemoryLayout))
+	{
+		m_error = std::string("'") + path + "' is not a log memory file";
+		::close(fd);
+		return false;
+	}
+	void* memory = ::mmap(nullptr, sizeof(ExternalMemoryLayout), is_consuming ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (memory == MAP_FAILED)
+	{
+		m_error = std::string("unable to map '") + path + "': " + std::strerror(errno);
+		return false;
+	}
+
+	m_memory = (ExternalMemoryLayout*)memory;
+	m_is_consuming = is_consuming;
+	m_cursor = __atomic_load_n(&m_memory->log_tail, __ATOMIC_ACQUIRE);
+	return true;
+}
+
+void LogTail::Close()
+{
+	if (m_memory != nullptr)
+		::munmap(m_memory, sizeof(ExternalMemoryLayout));
+	m_memory = nullptr;
+	m_is_consuming = false;
+	m_cursor = 0;
+	m_lost_bytes = 0;
+	m_scratch.clear();
+	m_error.clear();
+}
+
+size_t LogTail::Poll(const std::function<void(std::string_view)>& fn)
+{
+	if (m_memory == nullptr)
+		return 0;
+
+	// The producer publishes log_head after the record data, so everything before it is complete.
+	uint32_t head = __atomic_load_n(&m_memory->log_head, __ATOMIC_ACQUIRE);
+	uint32_t tail = __atomic_load_n(&m_memory->log_tail, __ATOMIC_ACQUIRE);
+	if (m_cursor - tail > head - tail)
+	{
+		// The consumer released records we had not read yet, or the log was reset.
+		if ((int32_t)(tail - m_cursor) > 0)
+			m_lost_bytes += tail - m_cursor;
+		m_cursor = tail;
+	}
+
+	uint32_t start = m_cursor;
+	const char* buffer = m_memory->log_buffer;
+	while (m_cursor != head)
+	{
+		size_t offset = m_cursor & LOG_BUFFER_MASK;
+		size_t size = std::min<size_t>(head - m_cursor, LOG_BUFFER_SIZE - offset);
+		const char* data = buffer + offset;
+		const char* end = (const char*)std::memchr(data, '\n', size);
+		if (end != nullptr)
+		{
+			size_t line_size = end - data + 1;
+			fn(std::string_view(data, line_size));
+			m_cursor += line_size;
+			continue;
+		}
+		if (offset + size != LOG_BUFFER_SIZE)
+			break;
+
+		// The record crosses the wrap of the ring.
+		end = (const char*)std::memchr(buffer, '\n', head - m_cursor - size);
+		if (end == nullptr)
+			break;
+		m_scratch.assign(data, size);
+		m_scratch.append(buffer, end - buffer + 1);
+		fn(m_scratch);
+		m_cursor += m_scratch.size();
+	}
+
+	if (m_is_consuming && m_cursor != start)
+		__atomic_store_n(&m_memory->log_tail, m_cursor, __ATOMIC_RELEASE);
+	return m_cursor - start;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "rlm3-settings.h"
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+
+
+// Follows the log ring in a memory file shared with a running simulation (see SIM_LogMemory_MapFile).  Records from
+// log_tail to log_head are complete.  A consuming reader releases them by moving log_tail, the same as the firmware's
+// consumer, so it must be the only consumer.  A passive reader leaves log_tail alone and only sees the records the
+// consumer has not released yet.  Records released before it could read them may be overwritten at any time, so they
+// are skipped and counted as lost.
+class LogTail
+{
+public:
+	LogTail() = default;
+	LogTail(const LogTail&) = delete;
+	LogTail& operator=(const LogTail&) = delete;
+	~LogTail();
+
+	bool Open(const char* path, bool is_consuming);
+	void Close();
+
+	const std::string& GetError() const { return m_error; }
+	uint64_t GetLostBytes() const { return m_lost_bytes; }
+
+	// Calls fn for each record published since the last poll, including its newline.  Records are read in place and
+	// only a record that crosses the wrap of the ring is copied.  Returns the number of bytes read.
+	size_t Poll(const std::function<void(std::string_view)>& fn);
+
+private:
+	ExternalMemoryLayout* m_memory = nullptr;
+	bool m_is_consuming = false;
+	uint32_t m_cursor = 0;
+	uint64_t m_lost_bytes = 0;
+	std::string m_scratch;
+	std::string m_error;
+};
@@ -0,0 +1,218 @@
+#include "rlm3-log-decoder.hpp"
+#include "rlm3-log-index.hpp"
+#include "rlm3-log-tail.hpp"
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+
+static int Usage()
+{
+	std::fprintf(stderr,
+		"usage: rlm3-log-tool decode <capture>\n"
+		"       rlm3-log-tool index <capture> <index>\n"
+		"       rlm3-log-tool query <capture> <index> [--from ms] [--to ms] [--level name] [--zone name] [--type L|D|R|T]\n"
+		"       rlm3-log-tool tail <memory-file> [--consume]\n"
+		"\n"
+		"<capture> is a raw dump of ExternalMemoryLayout, a log snapshot or a captured uplink stream.\n"
+		"<memory-file> is the log memory of a running simulation (SIM_LogMemory_MapFile).  tail follows it until\n"
+		"interrupted, and with --consume also releases the records it reads like the firmware's consumer.\n");
+	return 2;
+}
+
+static const unsigned TAIL_POLL_INTERVAL_US = 10000;
+
+static volatile std::sig_atomic_t g_is_interrupted = 0;
+
+static void OnInterrupt(int)
+{
+	g_is_interrupted = 1;
+}
+
+static std::string_view SkipFields(std::string_view line, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		line.remove_prefix(std::min(line.size(), line.find(' ') + 1));
+	return line;
+}
+
+static void PrintRecord(const LogSource& source, const LogIndex& index, const LogIndexEntry& entry, std::string& scratch)
+{
+	// Interned records are printed with their names, which the index already has.
+	std::string_view line = source.Read(entry.offset, entry.size, scratch);
+	if (!line.empty() && line.back() == '\n')
+		line.remove_suffix(1);
+	std::string_view level = index.GetString(entry.level);
+	std::string_view zone = index.GetString(entry.zone);
+	if (entry.type == (uint8_t)LogRecordType::LOG && !line.empty() && line[0] == 'l')
+	{
+		std::string_view text = SkipFields(line, 4);
+		std::printf("L %u %.*s %.*s %.*s\n", entry.time, (int)level.size(), level.data(), (int)zone.size(), zone.data(), (int)text.size(), text.data());
+	}
+	else if (entry.type == (uint8_t)LogRecordType::DEBUG && !line.empty() && line[0] == 'd')
+	{
+		std::string_view text = SkipFields(line, 2);
+		std::printf("D %.*s %.*s\n", (int)zone.size(), zone.data(), (int)text.size(), text.data());
+	}
+	else
+	{
+		std::fwrite(line.data(), 1, line.size(), stdout);
+		std::fputc('\n', stdout);
+	}
+}
+
+static void PrintDecodedRecord(const LogRecord& record)
+{
+	switch (record.type)
+	{
+	case LogRecordType::LOG:
+		std::printf("%10u %-6.*s %-16.*s %.*s\n", record.time, (int)record.level.size(), record.level.data(), (int)record.zone.size(), record.zone.data(), (int)record.text.size(), record.text.data());
+		break;
+	case LogRecordType::DEBUG:
+		std::printf("%10s %-6s %-16.*s %.*s\n", "", "DEBUG", (int)record.zone.size(), record.zone.data(), (int)record.text.size(), record.text.data());
+		break;
+	case LogRecordType::RESPONSE:
+		std::printf("%10s %-6s %-16.*s %.*s\n", "", "RESP", (int)record.zone.size(), record.zone.data(), (int)record.text.size(), record.text.data());
+		break;
+	case LogRecordType::RAW:
+		std::printf("%10s %-6s %-16s %.*s\n", "", "RAW", "", (int)record.text.size(), record.text.data());
+		break;
+	case LogRecordType::INTERN:
+		break;
+	}
+}
+
+static int Decode(const LogSource& source)
+{
+	if (source.IsSnapshot())
+	{
+		const RLM3_LogSnapshotHeader& header = source.GetSnapshotHeader();
+		std::fprintf(stderr, "snapshot v%u: head %u tail %u", header.version, header.log_head, header.log_tail);
+		if (header.fault_magic == 0x464F554C)
+		{
+			std::string_view cause = source.GetSnapshotFaultCause();
+			std::string_view state = source.GetSnapshotFaultThreadState();
+			std::fprintf(stderr, " fault '%.*s' COMM: %.*s", (int)cause.size(), cause.data(), (int)state.size(), state.data());
+		}
+		std::fputc('\n', stderr);
+	}
+
+	uint64_t count = source.Decode(PrintDecodedRecord);
+	std::fprintf(stderr, "%llu records\n", (unsigned long long)count);
+	return 0;
+}
+
+static int Tail(const char* path, bool is_consuming)
+{
+	LogTail tail;
+	if (!tail.Open(path, is_consuming))
+	{
+		std::fprintf(stderr, "rlm3-log-tool: %s\n", tail.GetError().c_str());
+		return 1;
+	}
+
+	// Names are defined once per session, so records from before the tail started may only show their ids.
+	std::signal(SIGINT, OnInterrupt);
+	std::signal(SIGTERM, OnInterrupt);
+	LogInternTable table;
+	uint64_t offset = 0;
+	uint64_t count = 0;
+	while (!g_is_interrupted)
+	{
+		size_t size = tail.Poll([&](std::string_view line)
+		{
+			LogRecord record;
+			ParseLogRecord(line, offset, &record, &table);
+			PrintDecodedRecord(record);
+			offset += line.size();
+			count++;
+		});
+		if (size == 0)
+		{
+			std::fflush(stdout);
+			::usleep(TAIL_POLL_INTERVAL_US);
+		}
+	}
+	std::fprintf(stderr, "%llu records, %llu bytes lost\n", (unsigned long long)count, (unsigned long long)tail.GetLostBytes());
+	return 0;
+}
+
+static int Index(const LogSource& source, const char* path)
+{
+	std::string error;
+	bool is_ok = WriteLogIndex(source, path, &error);
+	if (!error.empty())
+		std::fprintf(stderr, "rlm3-log-tool: %s\n", error.c_str());
+	return is_ok ? 0 : 1;
+}
+
+static int Query(const LogSource& source, const char* path, int argc, char** argv)
+{
+	LogQuery query;
+	for (int i = 0; i < argc; i += 2)
+	{
+		if (i + 1 >= argc)
+			return Usage();
+		const char* option = argv[i];
+		const char* value = argv[i + 1];
+		if (std::strcmp(option, "--from") == 0 || std::strcmp(option, "--to") == 0)
+		{
+			if (!query.has_time_range)
+				query.time_to = UINT32_MAX;
+			query.has_time_range = true;
+			uint32_t time = (uint32_t)std::strtoul(value, nullptr, 0);
+			if (option[2] == 'f')
+				query.time_from = time;
+			else
+				query.time_to = time;
+		}
+		else if (std::strcmp(option, "--level") == 0)
+			query.level = value;
+		else if (std::strcmp(option, "--zone") == 0)
+			query.zone = value;
+		else if (std::strcmp(option, "--type") == 0 && std::strlen(value) == 1)
+			query.type = value[0];
+		else
+			return Usage();
+	}
+
+	LogIndex index;
+	if (!index.Open(path, source))
+	{
+		std::fprintf(stderr, "rlm3-log-tool: %s\n", index.GetError().c_str());
+		return 1;
+	}
+	std::string scratch;
+	uint64_t count = index.Query(query, [&](const LogIndexEntry& entry) { PrintRecord(source, index, entry, scratch); });
+	std::fprintf(stderr, "%llu of %llu records\n", (unsigned long long)count, (unsigned long long)index.GetEntryCount());
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+		return Usage();
+
+	const char* command = argv[1];
+	if (std::strcmp(command, "tail") == 0 && (argc == 3 || (argc == 4 && std::strcmp(argv[3], "--consume") == 0)))
+		return Tail(argv[2], argc == 4);
+
+	LogSource source;
+	if (!source.Open(argv[2]))
+	{
+		std::fprintf(stderr, "rlm3-log-tool: %s\n", source.GetError().c_str());
+		return 1;
+	}
+
+	if (std::strcmp(command, "decode") == 0 && argc == 3)
+		return Decode(source);
+	if (std::strcmp(command, "index") == 0 && argc == 4)
+		return Index(source, argv[3]);
+	if (std::strcmp(command, "query") == 0 && argc >= 4)
+		return Query(source, argv[3], argc - 4, argv + 4);
+	return Usage();
+}